@@ -0,0 +1,80 @@
+#include <chrono>
+#include <print>
+#include <vector>
+
+#include "Math.h"
+
+// Times the matrix chains a frame builds, nesting the two matrix multiply as
+// build_frame used to against the fused chains. The inputs cycle through a
+// table of rotations so nothing folds away at compile time
+
+void run_math_benchmark()
+{
+    const auto iterations = 4000000;
+
+    const auto n_matrices = 64;
+
+    auto rotations = std::vector<Matrix4x4>();
+
+    for (auto i = 0; i < n_matrices; i++)
+    {
+        const auto angle = static_cast<float>(i) * 0.1f;
+
+        rotations.push_back(Matrix4x4::make_rotation_x(angle));
+        rotations.push_back(Matrix4x4::make_rotation_y(angle));
+        rotations.push_back(Matrix4x4::make_rotation_z(angle));
+    }
+
+    const auto translation = Matrix4x4::make_translation(0.0f, 0.0f, 10.0f);
+
+    const auto projection = Matrix4x4::make_projection(90.0f, 0.65f, 0.1f, 1000.0f);
+
+    const auto target = Vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+    auto checksum = 0.0f;
+
+    const auto time = [&](const char *name, const auto &body)
+    {
+        const auto t1 = std::chrono::steady_clock::now();
+
+        for (auto i = 0; i < iterations; i++)
+        {
+            const auto *m = &rotations[(i % n_matrices) * 3];
+
+            checksum += body(m[0], m[1], m[2]);
+        }
+
+        const auto t2 = std::chrono::steady_clock::now();
+
+        std::println("  {} - {:.2f} ns", name, std::chrono::duration<double, std::nano>(t2 - t1).count() / iterations);
+    };
+
+    std::println("math benchmark: {} iterations", iterations);
+
+    time("world, nested", [&](const Matrix4x4 &a, const Matrix4x4 &b, const Matrix4x4 &)
+         { return Matrix4x4::multiply(Matrix4x4::multiply(a, b), translation).at(3, 2); });
+
+    time("world, fused", [&](const Matrix4x4 &a, const Matrix4x4 &b, const Matrix4x4 &)
+         { return Matrix4x4::multiply(a, b, translation).at(3, 2); });
+
+    time("four matrices, nested", [&](const Matrix4x4 &a, const Matrix4x4 &b, const Matrix4x4 &c)
+         { return Matrix4x4::multiply(Matrix4x4::multiply(Matrix4x4::multiply(a, b), c), projection).at(3, 2); });
+
+    time("four matrices, fused", [&](const Matrix4x4 &a, const Matrix4x4 &b, const Matrix4x4 &c)
+         { return Matrix4x4::multiply(a, b, c, projection).at(3, 2); });
+
+    time("look direction, nested", [&](const Matrix4x4 &a, const Matrix4x4 &b, const Matrix4x4 &c)
+         { return Matrix4x4::multiply_vector(Matrix4x4::multiply(Matrix4x4::multiply(a, b), c), target).x(); });
+
+    time("look direction, fused", [&](const Matrix4x4 &a, const Matrix4x4 &b, const Matrix4x4 &c)
+         { return Matrix4x4::transform(target, a, b, c).x(); });
+
+    std::println("  checksum {}", checksum);
+}
+
+int main()
+{
+    run_math_benchmark();
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+
+class Error
+{
+public:
+    Error(
+        const std::string &type,
+        const std::optional<std::string> &message = std::nullopt)
+        : m_type(type), m_message(message) {}
+
+    Error(
+        std::string &&type,
+        std::optional<std::string> &&message)
+        : m_type(std::move(type)), m_message(std::move(message)) {}
+
+    const std::string &type() const { return m_type; }
+
+    const std::optional<std::string> &message() const { return m_message; }
+
+private:
+    std::string m_type;
+    std::optional<std::string> m_message;
+};
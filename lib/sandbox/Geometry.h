@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "Math.h"
+
+// 8 bit RGBA, laid out like SDL_Color so it can stand in for it without the
+// library depending on SDL
+
+struct Color
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+};
+
+class Triangle
+{
+public:
+    constexpr Triangle()
+        : m_points{Vec4(0.0f, 0.0f, 0.0f), Vec4(0.0f, 0.0f, 0.0f), Vec4(0.0f, 0.0f, 0.0f)}, m_color{0xff, 0xff, 0xff, 0xff} {}
+
+    constexpr Triangle(float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3)
+        : m_points{Vec4(x1, y1, z1), Vec4(x2, y2, z2), Vec4(x3, y3, z3)}, m_color{0xff, 0xff, 0xff, 0xff} {}
+
+    constexpr Triangle(float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3, const Color &color)
+        : m_points{Vec4(x1, y1, z1), Vec4(x2, y2, z2), Vec4(x3, y3, z3)}, m_color(color) {}
+
+    constexpr Triangle(const Vec4 &p0, const Vec4 &p1, const Vec4 &p2)
+        : m_points{p0, p1, p2}, m_color{0xff, 0xff, 0xff, 0xff} {}
+
+    constexpr Triangle(const Vec4 &p0, const Vec4 &p1, const Vec4 &p2, const Color &color)
+        : m_points{p0, p1, p2}, m_color(color) {}
+
+    constexpr Triangle(const Triangle &other) = default;
+
+    constexpr Triangle &operator=(const Triangle &other) = default;
+
+    constexpr const Vec4 &point_at(int index) const { return m_points[index]; }
+
+    constexpr void set_point_at(int index, const Vec4 &point)
+    {
+        m_points[index] = point;
+    }
+
+    constexpr void set_x_on_point_at(int index, float x)
+    {
+        m_points[index].x(x);
+    }
+
+    constexpr void set_y_on_point_at(int index, float y)
+    {
+        m_points[index].y(y);
+    }
+
+    constexpr void set_z_on_point_at(int index, float z)
+    {
+        m_points[index].z(z);
+    }
+
+    constexpr const Color &color() const { return m_color; }
+
+    constexpr void set_color(const Color &color)
+    {
+        m_color = color;
+    }
+
+    static constexpr float shortest_distance(
+        const Vec4 &plane_p,
+        const Vec4 &plane_n,
+        const Vec4 &p)
+    {
+        return plane_n.x() * p.x() + plane_n.y() * p.y() + plane_n.z() * p.z() - Vec4::dot_product(plane_n, plane_p);
+    }
+
+    static int clip_against_plane(
+        const Vec4 &plane_p,
+        const Vec4 &plane_n,
+        const Triangle &in_tri,
+        Triangle *out_tri1,
+        Triangle *out_tri2)
+    {
+        // Make sure plane normal is indeed normal
+
+        const auto _plane_n = Vec4::normalize(plane_n);
+
+        // Create two temporary storage arrays to classify points either side of plane
+        // If distance sign is positive, point lies on "inside" of plane
+
+        Vec4 inside_points[3] = {{}, {}, {}};
+        auto inside_point_count = 0;
+
+        Vec4 outside_points[3] = {{}, {}, {}};
+        auto outside_point_count = 0;
+
+        // Get signed distance of each point in triangle to plane
+
+        const auto d0 = Triangle::shortest_distance(plane_p, _plane_n, in_tri.m_points[0]);
+        const auto d1 = Triangle::shortest_distance(plane_p, _plane_n, in_tri.m_points[1]);
+        const auto d2 = Triangle::shortest_distance(plane_p, _plane_n, in_tri.m_points[2]);
+
+        if (d0 >= 0)
+        {
+            inside_points[inside_point_count++] = in_tri.m_points[0];
+        }
+        else
+        {
+            outside_points[outside_point_count++] = in_tri.m_points[0];
+        }
+
+        if (d1 >= 0)
+        {
+            inside_points[inside_point_count++] = in_tri.m_points[1];
+        }
+        else
+        {
+            outside_points[outside_point_count++] = in_tri.m_points[1];
+        }
+
+        if (d2 >= 0)
+        {
+            inside_points[inside_point_count++] = in_tri.m_points[2];
+        }
+        else
+        {
+            outside_points[outside_point_count++] = in_tri.m_points[2];
+        }
+
+        // Now classify triangle points, and break the input triangle into
+        // smaller output triangles if required. There are four possible
+        // outcomes...
+
+        if (inside_point_count == 0)
+        {
+            // All points lie on the outside of plane, so clip whole triangle
+            // It ceases to exist
+
+            return 0; // No returned triangles are valid
+        }
+
+        if (inside_point_count == 3)
+        {
+            // All points lie on the inside of plane, so do nothing
+            // and allow the triangle to simply pass through
+
+            out_tri1->m_color = in_tri.m_color;
+
+            out_tri1->m_points[0] = inside_points[0];
+            out_tri1->m_points[1] = inside_points[1];
+            out_tri1->m_points[2] = inside_points[2];
+
+            return 1; // Just the one returned original triangle is valid
+        }
+
+        if (inside_point_count == 1 && outside_point_count == 2)
+        {
+            // Triangle should be clipped. As two points lie outside
+            // the plane, the triangle simply becomes a smaller triangle
+
+            // Copy appearance info to new triangle
+
+            out_tri1->m_color = in_tri.m_color;
+
+            // The inside point is valid, so keep that...
+
+            out_tri1->m_points[0] = inside_points[0];
+
+            // but the two new points are at the locations where the
+            // original sides of the triangle (lines) intersect with the plane
+
+            out_tri1->m_points[1] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[0], outside_points[0]);
+            out_tri1->m_points[2] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[0], outside_points[1]);
+
+            return 1; // Return the newly formed single triangle
+        }
+
+        if (inside_point_count == 2 && outside_point_count == 1)
+        {
+            // Triangle should be clipped. As two points lie inside the plane,
+            // the clipped triangle becomes a "quad". Fortunately, we can
+            // represent a quad with two new triangles
+
+            // Copy appearance info to new triangles
+
+            out_tri1->m_color = in_tri.m_color;
+            out_tri2->m_color = in_tri.m_color;
+
+            // The first triangle consists of the two inside points and a new
+            // point determined by the location where one side of the triangle
+            // intersects with the plane
+
+            out_tri1->m_points[0] = inside_points[0];
+            out_tri1->m_points[1] = inside_points[1];
+            out_tri1->m_points[2] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[0], outside_points[0]);
+
+            // The second triangle is composed of one of he inside points, a
+            // new point determined by the intersection of the other side of the
+            // triangle and the plane, and the newly created point above
+
+            out_tri2->m_points[0] = inside_points[1];
+            out_tri2->m_points[1] = out_tri1->m_points[2];
+            out_tri2->m_points[2] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[1], outside_points[0]);
+
+            return 2; // Return two newly formed triangles which form a quad
+        }
+
+        return 0; // No returned triangles are valid
+    }
+
+private:
+    Vec4 m_points[3];
+    Color m_color;
+};
+
+static_assert(std::is_trivially_copyable_v<Color> && std::is_trivially_copyable_v<Triangle>);
@@ -0,0 +1,500 @@
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+// Row vector maths, a point v goes to v * M. Everything here is trivially
+// copyable and usable in constant expressions, apart from what needs sqrt,
+// sin or cos
+
+class alignas(16) Vec4
+{
+public:
+    constexpr Vec4()
+        : m_x(0.0f), m_y(0.0f), m_z(0.0f), m_w(1.0f) {}
+
+    constexpr Vec4(float x, float y, float z)
+        : m_x(x), m_y(y), m_z(z), m_w(1.0f) {}
+
+    constexpr Vec4(float x, float y, float z, float w)
+        : m_x(x), m_y(y), m_z(z), m_w(w) {}
+
+    // Plain member-wise copies, so Vec4 stays trivially copyable and cheap to
+    // return by value
+
+    constexpr Vec4(const Vec4 &other) = default;
+
+    constexpr Vec4(Vec4 &&other) = default;
+
+    constexpr Vec4 &operator=(const Vec4 &other) = default;
+
+    constexpr const float &x() const { return m_x; }
+
+    constexpr const float &y() const { return m_y; }
+
+    constexpr const float &z() const { return m_z; }
+
+    constexpr const float &w() const { return m_w; }
+
+    constexpr void x(float x)
+    {
+        m_x = x;
+    }
+
+    constexpr void y(float y)
+    {
+        m_y = y;
+    }
+
+    constexpr void z(float z)
+    {
+        m_z = z;
+    }
+
+    constexpr void w(float w)
+    {
+        m_w = w;
+    }
+
+    static constexpr Vec4 add(
+        const Vec4 &lhs,
+        const Vec4 &rhs)
+    {
+        return Vec4(
+            lhs.m_x + rhs.m_x,
+            lhs.m_y + rhs.m_y,
+            lhs.m_z + rhs.m_z);
+    }
+
+    static constexpr Vec4 subtract(
+        const Vec4 &lhs,
+        const Vec4 &rhs)
+    {
+        return Vec4(
+            lhs.m_x - rhs.m_x,
+            lhs.m_y - rhs.m_y,
+            lhs.m_z - rhs.m_z);
+    }
+
+    static constexpr Vec4 multiply(
+        const Vec4 &lhs,
+        float k)
+    {
+        return Vec4(
+            lhs.m_x * k,
+            lhs.m_y * k,
+            lhs.m_z * k);
+    }
+
+    static constexpr Vec4 divide(
+        const Vec4 &lhs,
+        float k)
+    {
+        return Vec4(
+            lhs.m_x / k,
+            lhs.m_y / k,
+            lhs.m_z / k);
+    }
+
+    static constexpr float dot_product(
+        const Vec4 &lhs,
+        const Vec4 &rhs)
+    {
+        return lhs.m_x * rhs.m_x +
+               lhs.m_y * rhs.m_y +
+               lhs.m_z * rhs.m_z;
+    }
+
+    static float length(
+        const Vec4 &vec)
+    {
+        return std::sqrt(Vec4::dot_product(vec, vec));
+    }
+
+    static float distance(
+        const Vec4 &a,
+        const Vec4 &b)
+    {
+        const auto dx = b.x() - a.x();
+        const auto dy = b.y() - a.y();
+        const auto dz = b.z() - a.z();
+
+        return std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    static Vec4 normalize(
+        const Vec4 &vec)
+    {
+        const auto len = Vec4::length(vec);
+
+        return Vec4(
+            vec.m_x / len,
+            vec.m_y / len,
+            vec.m_z / len);
+    }
+
+    static constexpr Vec4 cross_product(
+        const Vec4 &lhs,
+        const Vec4 &rhs)
+    {
+        return Vec4(
+            lhs.m_y * rhs.m_z - lhs.m_z * rhs.m_y,
+            lhs.m_z * rhs.m_x - lhs.m_x * rhs.m_z,
+            lhs.m_x * rhs.m_y - lhs.m_y * rhs.m_x);
+    }
+
+    static Vec4 intersect_plane(
+        const Vec4 &plane_p,
+        const Vec4 &plane_n,
+        const Vec4 &line_start,
+        const Vec4 &line_end)
+    {
+        const auto plane_n_norm = Vec4::normalize(plane_n);
+        const auto plane_d = -Vec4::dot_product(plane_n_norm, plane_p);
+        const auto ad = Vec4::dot_product(line_start, plane_n_norm);
+        const auto bd = Vec4::dot_product(line_end, plane_n_norm);
+        const auto t = (-plane_d - ad) / (bd - ad);
+        const auto line_start_to_end = Vec4::subtract(line_end, line_start);
+        const auto line_to_intersect = Vec4::multiply(line_start_to_end, t);
+        return Vec4::add(line_start, line_to_intersect);
+    }
+
+private:
+    float m_x;
+    float m_y;
+    float m_z;
+    float m_w;
+};
+
+class alignas(16) Matrix4x4
+{
+public:
+    constexpr Matrix4x4(
+        float matrix[4][4])
+        : m_matrix{
+              {matrix[0][0], matrix[0][1], matrix[0][2], matrix[0][3]},
+              {matrix[1][0], matrix[1][1], matrix[1][2], matrix[1][3]},
+              {matrix[2][0], matrix[2][1], matrix[2][2], matrix[2][3]},
+              {matrix[3][0], matrix[3][1], matrix[3][2], matrix[3][3]}} {}
+
+    constexpr Matrix4x4()
+        : m_matrix{
+              {0.0f, 0.0f, 0.0f, 0.0f},
+              {0.0f, 0.0f, 0.0f, 0.0f},
+              {0.0f, 0.0f, 0.0f, 0.0f},
+              {0.0f, 0.0f, 0.0f, 0.0f}} {}
+
+    constexpr Matrix4x4(
+        float m0, float m1, float m2, float m3,
+        float m4, float m5, float m6, float m7,
+        float m8, float m9, float ma, float mb,
+        float mc, float md, float me, float mf)
+        : m_matrix{
+              {m0, m1, m2, m3},
+              {m4, m5, m6, m7},
+              {m8, m9, ma, mb},
+              {mc, md, me, mf}} {}
+
+    constexpr Matrix4x4(const Matrix4x4 &other) = default;
+
+    constexpr Matrix4x4(Matrix4x4 &&other) = default;
+
+    constexpr Matrix4x4 &operator=(const Matrix4x4 &other) = default;
+
+    static constexpr Vec4 multiply_vector(
+        const Matrix4x4 &m,
+        const Vec4 &i)
+    {
+        return Vec4(
+            i.x() * m.m_matrix[0][0] + i.y() * m.m_matrix[1][0] + i.z() * m.m_matrix[2][0] + m.m_matrix[3][0],
+            i.x() * m.m_matrix[0][1] + i.y() * m.m_matrix[1][1] + i.z() * m.m_matrix[2][1] + m.m_matrix[3][1],
+            i.x() * m.m_matrix[0][2] + i.y() * m.m_matrix[1][2] + i.z() * m.m_matrix[2][2] + m.m_matrix[3][2],
+            i.x() * m.m_matrix[0][3] + i.y() * m.m_matrix[1][3] + i.z() * m.m_matrix[2][3] + m.m_matrix[3][3]);
+    }
+
+    static constexpr Vec4 multiply_direction(
+        const Matrix4x4 &m,
+        const Vec4 &i)
+    {
+        // As multiply_vector, but ignores the translation row
+
+        return Vec4(
+            i.x() * m.m_matrix[0][0] + i.y() * m.m_matrix[1][0] + i.z() * m.m_matrix[2][0],
+            i.x() * m.m_matrix[0][1] + i.y() * m.m_matrix[1][1] + i.z() * m.m_matrix[2][1],
+            i.x() * m.m_matrix[0][2] + i.y() * m.m_matrix[1][2] + i.z() * m.m_matrix[2][2]);
+    }
+
+    static constexpr Matrix4x4 make_identity()
+    {
+        return Matrix4x4(
+            1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, 1.0f, 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    static Matrix4x4 make_rotation_x(
+        float angle_rad)
+    {
+        return Matrix4x4(
+            1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, std::cos(angle_rad), std::sin(angle_rad), 0.0f,
+            0.0f, -std::sin(angle_rad), std::cos(angle_rad), 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    static Matrix4x4 make_rotation_y(
+        float angle_rad)
+    {
+        return Matrix4x4(
+            std::cos(angle_rad), 0.0f, -std::sin(angle_rad), 0.0f,
+            0.0f, 1.0f, 0.0f, 0.0f,
+            std::sin(angle_rad), 0.0f, std::cos(angle_rad), 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    static Matrix4x4 make_rotation_z(
+        float angle_rad)
+    {
+        return Matrix4x4(
+            std::cos(angle_rad), std::sin(angle_rad), 0.0f, 0.0f,
+            -std::sin(angle_rad), std::cos(angle_rad), 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    static constexpr Matrix4x4 make_translation(
+        float x,
+        float y,
+        float z)
+    {
+        return Matrix4x4(
+            1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, 1.0f, 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f, 0.0f,
+            x, y, z, 1.0f);
+    }
+
+    // std::tan isn't constexpr, so constant projections use the sin and cos
+    // series instead, which converge well past float precision for the small
+    // angles a field of view gives
+
+    static constexpr double constexpr_tan(
+        double x)
+    {
+        auto sin = 0.0;
+        auto cos = 0.0;
+
+        auto term = 1.0;
+
+        for (auto n = 0; n < 24; n++)
+        {
+            if (n % 2 == 0)
+            {
+                cos += (n % 4 == 0) ? term : -term;
+            }
+            else
+            {
+                sin += (n % 4 == 1) ? term : -term;
+            }
+
+            term *= x / (n + 1);
+        }
+
+        return sin / cos;
+    }
+
+    static constexpr Matrix4x4 make_projection(
+        float fov_degrees,
+        float aspect_ratio,
+        float near,
+        float far)
+    {
+        const auto half_fov = fov_degrees * 0.5f / 180.0f * 3.14159f;
+
+        auto tan_half_fov = 0.0f;
+
+        if consteval
+        {
+            tan_half_fov = static_cast<float>(constexpr_tan(half_fov));
+        }
+        else
+        {
+            tan_half_fov = std::tan(half_fov);
+        }
+
+        const auto fov_rad = 1.0f / tan_half_fov;
+
+        return Matrix4x4(
+            aspect_ratio * fov_rad, 0.0f, 0.0f, 0.0f,
+            0.0f, fov_rad, 0.0f, 0.0f,
+            0.0f, 0.0f, far / (far - near), 1.0f,
+            0.0f, 0.0f, (-far * near) / (far - near), 0.0f);
+    }
+
+    static constexpr Matrix4x4 multiply(
+        const Matrix4x4 &m1,
+        const Matrix4x4 &m2)
+    {
+        Matrix4x4 matrix;
+
+        for (auto r = 0; r < 4; r++)
+        {
+            multiply_row(m1.m_matrix[r], m2, matrix.m_matrix[r]);
+        }
+
+        return matrix;
+    }
+
+    // A whole chain m1 * m2 * m3 * ... in one pass. Each row of m1 is carried
+    // through the rest in turn, so no intermediate product is ever built, and
+    // the sums run in the same order as nesting the two matrix multiply
+
+    template <typename... Rest>
+    static constexpr Matrix4x4 multiply(
+        const Matrix4x4 &m1,
+        const Matrix4x4 &m2,
+        const Matrix4x4 &m3,
+        const Rest &...rest)
+    {
+        Matrix4x4 matrix;
+
+        for (auto r = 0; r < 4; r++)
+        {
+            float row[4] = {m1.m_matrix[r][0], m1.m_matrix[r][1], m1.m_matrix[r][2], m1.m_matrix[r][3]};
+
+            const auto next = [&row](const Matrix4x4 &m)
+            {
+                float out[4] = {};
+
+                multiply_row(row, m, out);
+
+                for (auto c = 0; c < 4; c++)
+                {
+                    row[c] = out[c];
+                }
+            };
+
+            next(m2);
+            next(m3);
+            (next(rest), ...);
+
+            for (auto c = 0; c < 4; c++)
+            {
+                matrix.m_matrix[r][c] = row[c];
+            }
+        }
+
+        return matrix;
+    }
+
+    // multiply_vector through each matrix in turn, 16 multiplies a matrix rather
+    // than the 64 it takes to build each product first when only one vector goes
+    // through the chain
+
+    template <typename... Rest>
+    static constexpr Vec4 transform(
+        const Vec4 &i,
+        const Matrix4x4 &m,
+        const Rest &...rest)
+    {
+        auto v = multiply_vector(m, i);
+
+        ((v = multiply_vector(rest, v)), ...);
+
+        return v;
+    }
+
+    static Matrix4x4 point_at(
+        const Vec4 &pos,
+        const Vec4 &target,
+        const Vec4 &up)
+    {
+        // Calculate new forward direction
+
+        auto new_forward = Vec4::subtract(target, pos);
+
+        new_forward = Vec4::normalize(new_forward);
+
+        // Calculate new up direction
+
+        const auto a = Vec4::multiply(new_forward, Vec4::dot_product(up, new_forward));
+
+        auto new_up = Vec4::subtract(up, a);
+
+        new_up = Vec4::normalize(new_up);
+
+        // New right direction is easy, its just cross product
+
+        const auto new_right = Vec4::cross_product(new_up, new_forward);
+
+        // Construct Dimensioning and Translation Matrix
+
+        return Matrix4x4(
+            new_right.x(), new_right.y(), new_right.z(), 0.0f,
+            new_up.x(), new_up.y(), new_up.z(), 0.0f,
+            new_forward.x(), new_forward.y(), new_forward.z(), 0.0f,
+            pos.x(), pos.y(), pos.z(), 1.0f);
+    }
+
+    static constexpr Matrix4x4 quick_inverse(
+        const Matrix4x4 &m)
+    {
+        // return Matrix4x4(
+        //     m.m_matrix[0][0], m.m_matrix[1][0], m.m_matrix[2][0], 0.0f,
+        //     m.m_matrix[0][1], m.m_matrix[1][1], m.m_matrix[2][1], 0.0f,
+        //     m.m_matrix[0][2], m.m_matrix[1][2], m.m_matrix[2][2], 0.0f,
+        //     -(m.m_matrix[3][0] * m.m_matrix[0][0] + m.m_matrix[3][1] * m.m_matrix[1][0] + m.m_matrix[3][2] * m.m_matrix[2][0]),
+        //     -(m.m_matrix[3][0] * m.m_matrix[0][1] + m.m_matrix[3][1] * m.m_matrix[1][1] + m.m_matrix[3][2] * m.m_matrix[2][1]),
+        //     -(m.m_matrix[3][0] * m.m_matrix[0][2] + m.m_matrix[3][1] * m.m_matrix[1][2] + m.m_matrix[3][2] * m.m_matrix[2][2]),
+        //     1.0f);
+
+        Matrix4x4 matrix;
+        matrix.m_matrix[0][0] = m.m_matrix[0][0];
+        matrix.m_matrix[0][1] = m.m_matrix[1][0];
+        matrix.m_matrix[0][2] = m.m_matrix[2][0];
+        matrix.m_matrix[0][3] = 0.0f;
+        matrix.m_matrix[1][0] = m.m_matrix[0][1];
+        matrix.m_matrix[1][1] = m.m_matrix[1][1];
+        matrix.m_matrix[1][2] = m.m_matrix[2][1];
+        matrix.m_matrix[1][3] = 0.0f;
+        matrix.m_matrix[2][0] = m.m_matrix[0][2];
+        matrix.m_matrix[2][1] = m.m_matrix[1][2];
+        matrix.m_matrix[2][2] = m.m_matrix[2][2];
+        matrix.m_matrix[2][3] = 0.0f;
+        matrix.m_matrix[3][0] = -(m.m_matrix[3][0] * matrix.m_matrix[0][0] + m.m_matrix[3][1] * matrix.m_matrix[1][0] + m.m_matrix[3][2] * matrix.m_matrix[2][0]);
+        matrix.m_matrix[3][1] = -(m.m_matrix[3][0] * matrix.m_matrix[0][1] + m.m_matrix[3][1] * matrix.m_matrix[1][1] + m.m_matrix[3][2] * matrix.m_matrix[2][1]);
+        matrix.m_matrix[3][2] = -(m.m_matrix[3][0] * matrix.m_matrix[0][2] + m.m_matrix[3][1] * matrix.m_matrix[1][2] + m.m_matrix[3][2] * matrix.m_matrix[2][2]);
+        matrix.m_matrix[3][3] = 1.0f;
+        return matrix;
+    }
+
+    constexpr const float &at(int row, int column) const { return m_matrix[row][column]; }
+
+    constexpr const float *row(int row) const { return m_matrix[row]; }
+
+private:
+    static constexpr void multiply_row(
+        const float (&row)[4],
+        const Matrix4x4 &m,
+        float (&out)[4])
+    {
+        for (auto c = 0; c < 4; c++)
+        {
+            out[c] = row[0] * m.m_matrix[0][c] + row[1] * m.m_matrix[1][c] + row[2] * m.m_matrix[2][c] + row[3] * m.m_matrix[3][c];
+        }
+    }
+
+    float m_matrix[4][4];
+};
+
+// The factories and chains are usable in constant expressions
+
+static_assert(Matrix4x4::multiply(Matrix4x4::make_translation(1.0f, 2.0f, 3.0f), Matrix4x4::make_identity(), Matrix4x4::make_translation(4.0f, 5.0f, 6.0f)).at(3, 1) == 7.0f);
+
+static_assert(Matrix4x4::transform(Vec4(1.0f, 0.0f, 0.0f), Matrix4x4::make_translation(0.0f, 1.0f, 0.0f), Matrix4x4::make_translation(0.0f, 0.0f, 2.0f)).z() == 2.0f);
+
+static_assert(Matrix4x4::make_projection(90.0f, 1.0f, 0.1f, 1000.0f).at(1, 1) > 0.9999f && Matrix4x4::make_projection(90.0f, 1.0f, 0.1f, 1000.0f).at(1, 1) < 1.0001f);
+
+static_assert(std::is_trivially_copyable_v<Vec4> && std::is_trivially_copyable_v<Matrix4x4>);
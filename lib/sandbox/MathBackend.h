@@ -0,0 +1,600 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Math.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SANDBOX_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SANDBOX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SANDBOX_TARGET(isa)
+#endif
+
+// Batched versions of the Vec4 and Matrix4x4 operations a frame spends most of
+// its time in, over structure of arrays inputs. Each instruction set gets its own
+// kernel set, and MathBackend hands out the one in use
+
+struct MathKernels
+{
+    const char *name;
+
+    // Batched multiply_vector: Model Space --> Clip Space --> Screen Space
+
+    void (*transform)(
+        const Matrix4x4 &m,
+        const float *__restrict in_x,
+        const float *__restrict in_y,
+        const float *__restrict in_z,
+        float *__restrict clip_x,
+        float *__restrict clip_y,
+        float *__restrict clip_z,
+        float *__restrict clip_w,
+        float *__restrict screen_x,
+        float *__restrict screen_y,
+        float *__restrict screen_z,
+        int count,
+        float half_width,
+        float half_height);
+
+    // Batched Vec4::cross_product
+
+    void (*cross_product)(
+        const float *__restrict ax,
+        const float *__restrict ay,
+        const float *__restrict az,
+        const float *__restrict bx,
+        const float *__restrict by,
+        const float *__restrict bz,
+        float *__restrict out_x,
+        float *__restrict out_y,
+        float *__restrict out_z,
+        int count);
+
+    // Batched Vec4::normalize, in place
+
+    void (*normalize)(
+        float *__restrict x,
+        float *__restrict y,
+        float *__restrict z,
+        int count);
+
+    // Outcodes of clip space points against the screen and against a guard band
+    // `guard_band` screens wide, one bit per plane the point lies beyond. The
+    // lateral planes are at +/- extent * w, clip z runs from 0 at the near plane
+    // to w at the far plane
+
+    void (*outcodes)(
+        const float *__restrict clip_x,
+        const float *__restrict clip_y,
+        const float *__restrict clip_z,
+        const float *__restrict clip_w,
+        uint8_t *__restrict screen_codes,
+        uint8_t *__restrict guard_codes,
+        int count,
+        float guard_band);
+};
+
+class MathBackend
+{
+public:
+    static const MathKernels &kernels() { return *s_active; }
+
+    static const MathKernels &scalar() { return s_scalar; }
+
+    // Every kernel set this CPU can run, widest first and ending with the scalar
+    // kernels
+
+    static std::vector<const MathKernels *> supported()
+    {
+        auto kernels = std::vector<const MathKernels *>();
+
+#if defined(SANDBOX_X86) && (defined(__GNUC__) || defined(__clang__))
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernels.push_back(&s_avx2);
+        }
+
+        if (__builtin_cpu_supports("sse4.1"))
+        {
+            kernels.push_back(&s_sse41);
+        }
+#endif
+
+        kernels.push_back(&s_scalar);
+
+        return kernels;
+    }
+
+    // Picks the widest kernel set this CPU supports. The sets are checked against
+    // each other by the backend tests rather than on every launch
+
+    static void initialize()
+    {
+        MathBackend::use(*MathBackend::supported().front());
+    }
+
+    static void use(
+        const MathKernels &kernels)
+    {
+        s_active = &kernels;
+    }
+
+private:
+    static void transform_scalar(
+        const Matrix4x4 &m,
+        const float *__restrict in_x,
+        const float *__restrict in_y,
+        const float *__restrict in_z,
+        float *__restrict clip_x,
+        float *__restrict clip_y,
+        float *__restrict clip_z,
+        float *__restrict clip_w,
+        float *__restrict screen_x,
+        float *__restrict screen_y,
+        float *__restrict screen_z,
+        int count,
+        float half_width,
+        float half_height)
+    {
+        const auto m00 = m.at(0, 0), m01 = m.at(0, 1), m02 = m.at(0, 2), m03 = m.at(0, 3);
+        const auto m10 = m.at(1, 0), m11 = m.at(1, 1), m12 = m.at(1, 2), m13 = m.at(1, 3);
+        const auto m20 = m.at(2, 0), m21 = m.at(2, 1), m22 = m.at(2, 2), m23 = m.at(2, 3);
+        const auto m30 = m.at(3, 0), m31 = m.at(3, 1), m32 = m.at(3, 2), m33 = m.at(3, 3);
+
+        // Kept branch free over contiguous, non-aliasing arrays so the compiler
+        // can vectorise it on targets without a hand written path
+
+        for (auto i = 0; i < count; i++)
+        {
+            const auto x = in_x[i];
+            const auto y = in_y[i];
+            const auto z = in_z[i];
+
+            const auto cx = x * m00 + y * m10 + z * m20 + m30;
+            const auto cy = x * m01 + y * m11 + z * m21 + m31;
+            const auto cz = x * m02 + y * m12 + z * m22 + m32;
+            const auto cw = x * m03 + y * m13 + z * m23 + m33;
+
+            clip_x[i] = cx;
+            clip_y[i] = cy;
+            clip_z[i] = cz;
+            clip_w[i] = cw;
+
+            // Perspective divide, X/Y are inverted so put them back, then
+            // offset into visible normalised space and scale to the viewport
+
+            const auto inv_w = 1.0f / cw;
+
+            screen_x[i] = (1.0f - cx * inv_w) * half_width;
+            screen_y[i] = (1.0f - cy * inv_w) * half_height;
+            screen_z[i] = cz * inv_w;
+        }
+    }
+
+    static void cross_product_scalar(
+        const float *__restrict ax,
+        const float *__restrict ay,
+        const float *__restrict az,
+        const float *__restrict bx,
+        const float *__restrict by,
+        const float *__restrict bz,
+        float *__restrict out_x,
+        float *__restrict out_y,
+        float *__restrict out_z,
+        int count)
+    {
+        for (auto i = 0; i < count; i++)
+        {
+            out_x[i] = ay[i] * bz[i] - az[i] * by[i];
+            out_y[i] = az[i] * bx[i] - ax[i] * bz[i];
+            out_z[i] = ax[i] * by[i] - ay[i] * bx[i];
+        }
+    }
+
+    static void normalize_scalar(
+        float *__restrict x,
+        float *__restrict y,
+        float *__restrict z,
+        int count)
+    {
+        for (auto i = 0; i < count; i++)
+        {
+            const auto len = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+
+            x[i] = x[i] / len;
+            y[i] = y[i] / len;
+            z[i] = z[i] / len;
+        }
+    }
+
+    static void outcodes_scalar(
+        const float *__restrict clip_x,
+        const float *__restrict clip_y,
+        const float *__restrict clip_z,
+        const float *__restrict clip_w,
+        uint8_t *__restrict screen_codes,
+        uint8_t *__restrict guard_codes,
+        int count,
+        float guard_band)
+    {
+        for (auto i = 0; i < count; i++)
+        {
+            const auto x = clip_x[i];
+            const auto y = clip_y[i];
+            const auto z = clip_z[i];
+            const auto w = clip_w[i];
+
+            const auto depth = (z < 0.0f ? 16 : 0) | (z > w ? 32 : 0);
+
+            const auto g = guard_band * w;
+
+            screen_codes[i] = static_cast<uint8_t>((x < -w ? 1 : 0) | (x > w ? 2 : 0) | (y < -w ? 4 : 0) | (y > w ? 8 : 0) | depth);
+            guard_codes[i] = static_cast<uint8_t>((x < -g ? 1 : 0) | (x > g ? 2 : 0) | (y < -g ? 4 : 0) | (y > g ? 8 : 0) | depth);
+        }
+    }
+
+#if defined(SANDBOX_X86)
+    // 4-wide and 8-wide versions of the scalar kernels above, doing the same
+    // operations in the same order (no FMA) so results match. Remainders go
+    // through the scalar kernels
+
+    SANDBOX_TARGET("sse4.1")
+    static void transform_sse41(
+        const Matrix4x4 &m,
+        const float *__restrict in_x,
+        const float *__restrict in_y,
+        const float *__restrict in_z,
+        float *__restrict clip_x,
+        float *__restrict clip_y,
+        float *__restrict clip_z,
+        float *__restrict clip_w,
+        float *__restrict screen_x,
+        float *__restrict screen_y,
+        float *__restrict screen_z,
+        int count,
+        float half_width,
+        float half_height)
+    {
+        __m128 mm[4][4];
+
+        for (auto r = 0; r < 4; r++)
+        {
+            const auto row = _mm_load_ps(m.row(r));
+
+            mm[r][0] = _mm_shuffle_ps(row, row, _MM_SHUFFLE(0, 0, 0, 0));
+            mm[r][1] = _mm_shuffle_ps(row, row, _MM_SHUFFLE(1, 1, 1, 1));
+            mm[r][2] = _mm_shuffle_ps(row, row, _MM_SHUFFLE(2, 2, 2, 2));
+            mm[r][3] = _mm_shuffle_ps(row, row, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+
+        const auto one = _mm_set1_ps(1.0f);
+        const auto hw = _mm_set1_ps(half_width);
+        const auto hh = _mm_set1_ps(half_height);
+
+        auto i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const auto x = _mm_loadu_ps(in_x + i);
+            const auto y = _mm_loadu_ps(in_y + i);
+            const auto z = _mm_loadu_ps(in_z + i);
+
+            __m128 c[4];
+
+            for (auto k = 0; k < 4; k++)
+            {
+                c[k] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, mm[0][k]), _mm_mul_ps(y, mm[1][k])), _mm_mul_ps(z, mm[2][k])), mm[3][k]);
+            }
+
+            _mm_storeu_ps(clip_x + i, c[0]);
+            _mm_storeu_ps(clip_y + i, c[1]);
+            _mm_storeu_ps(clip_z + i, c[2]);
+            _mm_storeu_ps(clip_w + i, c[3]);
+
+            const auto inv_w = _mm_div_ps(one, c[3]);
+
+            _mm_storeu_ps(screen_x + i, _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(c[0], inv_w)), hw));
+            _mm_storeu_ps(screen_y + i, _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(c[1], inv_w)), hh));
+            _mm_storeu_ps(screen_z + i, _mm_mul_ps(c[2], inv_w));
+        }
+
+        MathBackend::transform_scalar(m, in_x + i, in_y + i, in_z + i, clip_x + i, clip_y + i, clip_z + i, clip_w + i, screen_x + i, screen_y + i, screen_z + i, count - i, half_width, half_height);
+    }
+
+    SANDBOX_TARGET("sse4.1")
+    static void cross_product_sse41(
+        const float *__restrict ax,
+        const float *__restrict ay,
+        const float *__restrict az,
+        const float *__restrict bx,
+        const float *__restrict by,
+        const float *__restrict bz,
+        float *__restrict out_x,
+        float *__restrict out_y,
+        float *__restrict out_z,
+        int count)
+    {
+        auto i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const auto a_x = _mm_loadu_ps(ax + i), a_y = _mm_loadu_ps(ay + i), a_z = _mm_loadu_ps(az + i);
+            const auto b_x = _mm_loadu_ps(bx + i), b_y = _mm_loadu_ps(by + i), b_z = _mm_loadu_ps(bz + i);
+
+            _mm_storeu_ps(out_x + i, _mm_sub_ps(_mm_mul_ps(a_y, b_z), _mm_mul_ps(a_z, b_y)));
+            _mm_storeu_ps(out_y + i, _mm_sub_ps(_mm_mul_ps(a_z, b_x), _mm_mul_ps(a_x, b_z)));
+            _mm_storeu_ps(out_z + i, _mm_sub_ps(_mm_mul_ps(a_x, b_y), _mm_mul_ps(a_y, b_x)));
+        }
+
+        MathBackend::cross_product_scalar(ax + i, ay + i, az + i, bx + i, by + i, bz + i, out_x + i, out_y + i, out_z + i, count - i);
+    }
+
+    SANDBOX_TARGET("sse4.1")
+    static void normalize_sse41(
+        float *__restrict x,
+        float *__restrict y,
+        float *__restrict z,
+        int count)
+    {
+        auto i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const auto vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+
+            const auto len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+
+            _mm_storeu_ps(x + i, _mm_div_ps(vx, len));
+            _mm_storeu_ps(y + i, _mm_div_ps(vy, len));
+            _mm_storeu_ps(z + i, _mm_div_ps(vz, len));
+        }
+
+        MathBackend::normalize_scalar(x + i, y + i, z + i, count - i);
+    }
+
+    // Each comparison mask is ANDed with its plane's bit and the bits ORed into
+    // 32 bit lanes, which are then narrowed to one byte per point and stored
+
+    SANDBOX_TARGET("sse4.1")
+    static void store_outcodes_sse41(
+        uint8_t *out,
+        __m128 x,
+        __m128 y,
+        __m128 e,
+        __m128i depth)
+    {
+        const auto neg_e = _mm_xor_ps(e, _mm_set1_ps(-0.0f));
+
+        auto bits = depth;
+
+        bits = _mm_or_si128(bits, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(x, neg_e)), _mm_set1_epi32(1)));
+        bits = _mm_or_si128(bits, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(x, e)), _mm_set1_epi32(2)));
+        bits = _mm_or_si128(bits, _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(y, neg_e)), _mm_set1_epi32(4)));
+        bits = _mm_or_si128(bits, _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(y, e)), _mm_set1_epi32(8)));
+
+        const auto bytes = _mm_packus_epi16(_mm_packs_epi32(bits, bits), bits);
+
+        const auto packed = static_cast<uint32_t>(_mm_cvtsi128_si32(bytes));
+
+        std::memcpy(out, &packed, 4);
+    }
+
+    SANDBOX_TARGET("sse4.1")
+    static void outcodes_sse41(
+        const float *__restrict clip_x,
+        const float *__restrict clip_y,
+        const float *__restrict clip_z,
+        const float *__restrict clip_w,
+        uint8_t *__restrict screen_codes,
+        uint8_t *__restrict guard_codes,
+        int count,
+        float guard_band)
+    {
+        const auto gb = _mm_set1_ps(guard_band);
+        const auto zero = _mm_setzero_ps();
+
+        auto i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            const auto x = _mm_loadu_ps(clip_x + i);
+            const auto y = _mm_loadu_ps(clip_y + i);
+            const auto z = _mm_loadu_ps(clip_z + i);
+            const auto w = _mm_loadu_ps(clip_w + i);
+
+            const auto depth = _mm_or_si128(
+                _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(z, zero)), _mm_set1_epi32(16)),
+                _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(z, w)), _mm_set1_epi32(32)));
+
+            MathBackend::store_outcodes_sse41(screen_codes + i, x, y, w, depth);
+            MathBackend::store_outcodes_sse41(guard_codes + i, x, y, _mm_mul_ps(gb, w), depth);
+        }
+
+        MathBackend::outcodes_scalar(clip_x + i, clip_y + i, clip_z + i, clip_w + i, screen_codes + i, guard_codes + i, count - i, guard_band);
+    }
+
+    SANDBOX_TARGET("avx2")
+    static void transform_avx2(
+        const Matrix4x4 &m,
+        const float *__restrict in_x,
+        const float *__restrict in_y,
+        const float *__restrict in_z,
+        float *__restrict clip_x,
+        float *__restrict clip_y,
+        float *__restrict clip_z,
+        float *__restrict clip_w,
+        float *__restrict screen_x,
+        float *__restrict screen_y,
+        float *__restrict screen_z,
+        int count,
+        float half_width,
+        float half_height)
+    {
+        __m256 mm[4][4];
+
+        for (auto r = 0; r < 4; r++)
+        {
+            for (auto c = 0; c < 4; c++)
+            {
+                mm[r][c] = _mm256_broadcast_ss(m.row(r) + c);
+            }
+        }
+
+        const auto one = _mm256_set1_ps(1.0f);
+        const auto hw = _mm256_set1_ps(half_width);
+        const auto hh = _mm256_set1_ps(half_height);
+
+        auto i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const auto x = _mm256_loadu_ps(in_x + i);
+            const auto y = _mm256_loadu_ps(in_y + i);
+            const auto z = _mm256_loadu_ps(in_z + i);
+
+            __m256 c[4];
+
+            for (auto k = 0; k < 4; k++)
+            {
+                c[k] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, mm[0][k]), _mm256_mul_ps(y, mm[1][k])), _mm256_mul_ps(z, mm[2][k])), mm[3][k]);
+            }
+
+            _mm256_storeu_ps(clip_x + i, c[0]);
+            _mm256_storeu_ps(clip_y + i, c[1]);
+            _mm256_storeu_ps(clip_z + i, c[2]);
+            _mm256_storeu_ps(clip_w + i, c[3]);
+
+            const auto inv_w = _mm256_div_ps(one, c[3]);
+
+            _mm256_storeu_ps(screen_x + i, _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(c[0], inv_w)), hw));
+            _mm256_storeu_ps(screen_y + i, _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(c[1], inv_w)), hh));
+            _mm256_storeu_ps(screen_z + i, _mm256_mul_ps(c[2], inv_w));
+        }
+
+        MathBackend::transform_scalar(m, in_x + i, in_y + i, in_z + i, clip_x + i, clip_y + i, clip_z + i, clip_w + i, screen_x + i, screen_y + i, screen_z + i, count - i, half_width, half_height);
+    }
+
+    SANDBOX_TARGET("avx2")
+    static void cross_product_avx2(
+        const float *__restrict ax,
+        const float *__restrict ay,
+        const float *__restrict az,
+        const float *__restrict bx,
+        const float *__restrict by,
+        const float *__restrict bz,
+        float *__restrict out_x,
+        float *__restrict out_y,
+        float *__restrict out_z,
+        int count)
+    {
+        auto i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const auto a_x = _mm256_loadu_ps(ax + i), a_y = _mm256_loadu_ps(ay + i), a_z = _mm256_loadu_ps(az + i);
+            const auto b_x = _mm256_loadu_ps(bx + i), b_y = _mm256_loadu_ps(by + i), b_z = _mm256_loadu_ps(bz + i);
+
+            _mm256_storeu_ps(out_x + i, _mm256_sub_ps(_mm256_mul_ps(a_y, b_z), _mm256_mul_ps(a_z, b_y)));
+            _mm256_storeu_ps(out_y + i, _mm256_sub_ps(_mm256_mul_ps(a_z, b_x), _mm256_mul_ps(a_x, b_z)));
+            _mm256_storeu_ps(out_z + i, _mm256_sub_ps(_mm256_mul_ps(a_x, b_y), _mm256_mul_ps(a_y, b_x)));
+        }
+
+        MathBackend::cross_product_scalar(ax + i, ay + i, az + i, bx + i, by + i, bz + i, out_x + i, out_y + i, out_z + i, count - i);
+    }
+
+    SANDBOX_TARGET("avx2")
+    static void normalize_avx2(
+        float *__restrict x,
+        float *__restrict y,
+        float *__restrict z,
+        int count)
+    {
+        auto i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const auto vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+
+            const auto len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz)));
+
+            _mm256_storeu_ps(x + i, _mm256_div_ps(vx, len));
+            _mm256_storeu_ps(y + i, _mm256_div_ps(vy, len));
+            _mm256_storeu_ps(z + i, _mm256_div_ps(vz, len));
+        }
+
+        MathBackend::normalize_scalar(x + i, y + i, z + i, count - i);
+    }
+
+    SANDBOX_TARGET("avx2")
+    static void store_outcodes_avx2(
+        uint8_t *out,
+        __m256 x,
+        __m256 y,
+        __m256 e,
+        __m256i depth)
+    {
+        const auto neg_e = _mm256_xor_ps(e, _mm256_set1_ps(-0.0f));
+
+        auto bits = depth;
+
+        bits = _mm256_or_si256(bits, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, neg_e, _CMP_LT_OQ)), _mm256_set1_epi32(1)));
+        bits = _mm256_or_si256(bits, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, e, _CMP_GT_OQ)), _mm256_set1_epi32(2)));
+        bits = _mm256_or_si256(bits, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(y, neg_e, _CMP_LT_OQ)), _mm256_set1_epi32(4)));
+        bits = _mm256_or_si256(bits, _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(y, e, _CMP_GT_OQ)), _mm256_set1_epi32(8)));
+
+        const auto words = _mm_packs_epi32(_mm256_castsi256_si128(bits), _mm256_extracti128_si256(bits, 1));
+
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(words, words));
+    }
+
+    SANDBOX_TARGET("avx2")
+    static void outcodes_avx2(
+        const float *__restrict clip_x,
+        const float *__restrict clip_y,
+        const float *__restrict clip_z,
+        const float *__restrict clip_w,
+        uint8_t *__restrict screen_codes,
+        uint8_t *__restrict guard_codes,
+        int count,
+        float guard_band)
+    {
+        const auto gb = _mm256_set1_ps(guard_band);
+        const auto zero = _mm256_setzero_ps();
+
+        auto i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            const auto x = _mm256_loadu_ps(clip_x + i);
+            const auto y = _mm256_loadu_ps(clip_y + i);
+            const auto z = _mm256_loadu_ps(clip_z + i);
+            const auto w = _mm256_loadu_ps(clip_w + i);
+
+            const auto depth = _mm256_or_si256(
+                _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(z, zero, _CMP_LT_OQ)), _mm256_set1_epi32(16)),
+                _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(z, w, _CMP_GT_OQ)), _mm256_set1_epi32(32)));
+
+            MathBackend::store_outcodes_avx2(screen_codes + i, x, y, w, depth);
+            MathBackend::store_outcodes_avx2(guard_codes + i, x, y, _mm256_mul_ps(gb, w), depth);
+        }
+
+        MathBackend::outcodes_scalar(clip_x + i, clip_y + i, clip_z + i, clip_w + i, screen_codes + i, guard_codes + i, count - i, guard_band);
+    }
+
+    static inline const MathKernels s_sse41 = {"sse4.1", &MathBackend::transform_sse41, &MathBackend::cross_product_sse41, &MathBackend::normalize_sse41, &MathBackend::outcodes_sse41};
+
+    static inline const MathKernels s_avx2 = {"avx2", &MathBackend::transform_avx2, &MathBackend::cross_product_avx2, &MathBackend::normalize_avx2, &MathBackend::outcodes_avx2};
+#endif
+
+    static inline const MathKernels s_scalar = {"scalar", &MathBackend::transform_scalar, &MathBackend::cross_product_scalar, &MathBackend::normalize_scalar, &MathBackend::outcodes_scalar};
+
+    static inline const MathKernels *s_active = &s_scalar;
+};
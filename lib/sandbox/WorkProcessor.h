@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads pulling tasks from a shared queue
+
+class WorkProcessor
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkProcessor(
+        size_t num_threads)
+    {
+        for (size_t i = 0; i < num_threads; ++i)
+        {
+            m_workers.emplace_back(&WorkProcessor::worker_thread, this);
+        }
+    }
+
+    ~WorkProcessor()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_queue_mutex);
+
+            m_stop = true;
+        }
+
+        m_condition.notify_all();
+
+        for (auto &worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    static size_t default_thread_count()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    size_t thread_count() const { return m_workers.size(); }
+
+    void enqueue_task(
+        Task task)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_queue_mutex);
+
+            m_tasks.emplace(std::move(task));
+
+            m_pending++;
+        }
+
+        m_condition.notify_one();
+    }
+
+    // Block until every task enqueued so far has finished
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_queue_mutex);
+
+        m_done.wait(lock, [this]()
+                    { return m_pending == 0; });
+    }
+
+private:
+    void worker_thread()
+    {
+        while (true)
+        {
+            Task task;
+
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+
+                m_condition.wait(lock, [this]()
+                                 { return m_stop || !m_tasks.empty(); });
+
+                if (m_stop && m_tasks.empty())
+                {
+                    return;
+                }
+
+                task = std::move(m_tasks.front());
+
+                m_tasks.pop();
+            }
+
+            task();
+
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+
+                if (--m_pending == 0)
+                {
+                    m_done.notify_all();
+                }
+            }
+        }
+    }
+
+    std::vector<std::thread> m_workers;
+    std::queue<Task> m_tasks;
+    std::mutex m_queue_mutex;
+    std::condition_variable m_condition;
+    std::condition_variable m_done;
+    size_t m_pending = 0;
+    bool m_stop = false;
+};
@@ -1,471 +1,128 @@
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <istream>
+#include <limits>
+#include <mutex>
 #include <optional>
 #include <print>
+#include <queue>
 #include <sstream>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include <SDL3/SDL.h>
 
-class Error
-{
-public:
-    Error(
-        const std::string &type,
-        const std::optional<std::string> &message = std::nullopt)
-        : m_type(type), m_message(message) {}
-
-    Error(
-        std::string &&type,
-        std::optional<std::string> &&message)
-        : m_type(std::move(type)), m_message(std::move(message)) {}
-
-    Error(
-        const Error &other)
-        : m_type(other.m_type), m_message(other.m_message) {}
-
-    Error &operator=(
-        const Error &other)
-    {
-        if (this != &other)
-        {
-            m_type = other.m_type;
-            m_message = other.m_message;
-        }
+#include <png.h>
 
-        return *this;
-    }
-
-    ~Error() {}
-
-    const std::string &type() const { return m_type; }
-
-    const std::optional<std::string> &message() const { return m_message; }
+#include "Error.h"
+#include "Geometry.h"
+#include "Math.h"
+#include "MathBackend.h"
+#include "WorkProcessor.h"
 
-private:
-    std::string m_type;
-    std::optional<std::string> m_message;
-};
-
-class Vec4
+struct IndexedTriangle
 {
-public:
-    Vec4()
-        : m_x(0.0f), m_y(0.0f), m_z(0.0f), m_w(1.0f) {}
-
-    Vec4(float x, float y, float z)
-        : m_x(x), m_y(y), m_z(z), m_w(1.0f) {}
-
-    Vec4(float x, float y, float z, float w)
-        : m_x(x), m_y(y), m_z(z), m_w(w) {}
-
-    Vec4(const Vec4 &other)
-        : m_x(other.m_x), m_y(other.m_y), m_z(other.m_z), m_w(other.m_w) {}
-
-    Vec4(Vec4 &&other)
-        : m_x(std::move(other.m_x)), m_y(std::move(other.m_y)), m_z(std::move(other.m_z)), m_w(std::move(other.m_w)) {}
-
-    Vec4 &operator=(
-        const Vec4 &other)
-    {
-        if (this != &other)
-        {
-            m_x = other.m_x;
-            m_y = other.m_y;
-            m_z = other.m_z;
-            m_w = other.m_w;
-        }
-
-        return *this;
-    }
-
-    const float &x() const { return m_x; }
-
-    const float &y() const { return m_y; }
-
-    const float &z() const { return m_z; }
-
-    const float &w() const { return m_w; }
-
-    void x(float x)
-    {
-        m_x = x;
-    }
-
-    void y(float y)
-    {
-        m_y = y;
-    }
-
-    void z(float z)
-    {
-        m_z = z;
-    }
-
-    void w(float w)
-    {
-        m_w = w;
-    }
-
-    static Vec4 add(
-        const Vec4 &lhs,
-        const Vec4 &rhs)
-    {
-        return Vec4(
-            lhs.m_x + rhs.m_x,
-            lhs.m_y + rhs.m_y,
-            lhs.m_z + rhs.m_z);
-    }
-
-    static Vec4 subtract(
-        const Vec4 &lhs,
-        const Vec4 &rhs)
-    {
-        return Vec4(
-            lhs.m_x - rhs.m_x,
-            lhs.m_y - rhs.m_y,
-            lhs.m_z - rhs.m_z);
-    }
-
-    static Vec4 multiply(
-        const Vec4 &lhs,
-        float k)
-    {
-        return Vec4(
-            lhs.m_x * k,
-            lhs.m_y * k,
-            lhs.m_z * k);
-    }
-
-    static Vec4 divide(
-        const Vec4 &lhs,
-        float k)
-    {
-        return Vec4(
-            lhs.m_x / k,
-            lhs.m_y / k,
-            lhs.m_z / k);
-    }
-
-    static float dot_product(
-        const Vec4 &lhs,
-        const Vec4 &rhs)
-    {
-        return lhs.m_x * rhs.m_x +
-               lhs.m_y * rhs.m_y +
-               lhs.m_z * rhs.m_z;
-    }
-
-    static float length(
-        const Vec4 &vec)
-    {
-        return std::sqrt(Vec4::dot_product(vec, vec));
-    }
-
-    static float distance(
-        const Vec4 &a,
-        const Vec4 &b)
-    {
-        const auto dx = b.x() - a.x();
-        const auto dy = b.y() - a.y();
-        const auto dz = b.z() - a.z();
-
-        return std::sqrt(dx * dx + dy * dy + dz * dz);
-    }
-
-    static Vec4 normalize(
-        const Vec4 &vec)
-    {
-        const auto len = Vec4::length(vec);
-
-        return Vec4(
-            vec.m_x / len,
-            vec.m_y / len,
-            vec.m_z / len);
-    }
-
-    static Vec4 cross_product(
-        const Vec4 &lhs,
-        const Vec4 &rhs)
-    {
-        return Vec4(
-            lhs.m_y * rhs.m_z - lhs.m_z * rhs.m_y,
-            lhs.m_z * rhs.m_x - lhs.m_x * rhs.m_z,
-            lhs.m_x * rhs.m_y - lhs.m_y * rhs.m_x);
-    }
-
-    static Vec4 intersect_plane(
-        const Vec4 &plane_p,
-        const Vec4 &plane_n,
-        const Vec4 &line_start,
-        const Vec4 &line_end)
-    {
-        const auto plane_n_norm = Vec4::normalize(plane_n);
-        const auto plane_d = -Vec4::dot_product(plane_n_norm, plane_p);
-        const auto ad = Vec4::dot_product(line_start, plane_n_norm);
-        const auto bd = Vec4::dot_product(line_end, plane_n_norm);
-        const auto t = (-plane_d - ad) / (bd - ad);
-        const auto line_start_to_end = Vec4::subtract(line_end, line_start);
-        const auto line_to_intersect = Vec4::multiply(line_start_to_end, t);
-        return Vec4::add(line_start, line_to_intersect);
-    }
-
-private:
-    float m_x;
-    float m_y;
-    float m_z;
-    float m_w;
+    int indices[3];
+    Color color;
+    float depth;
+    int source; // mesh triangle this was produced from
 };
 
-class Triangle
+struct IndexRange
 {
-public:
-    Triangle()
-        : m_points{Vec4(0.0f, 0.0f, 0.0f), Vec4(0.0f, 0.0f, 0.0f), Vec4(0.0f, 0.0f, 0.0f)}, m_color{0xff, 0xff, 0xff, 0xff} {}
-
-    Triangle(float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3)
-        : m_points{Vec4(x1, y1, z1), Vec4(x2, y2, z2), Vec4(x3, y3, z3)}, m_color{0xff, 0xff, 0xff, 0xff} {}
-
-    Triangle(float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3, const SDL_Color &color)
-        : m_points{Vec4(x1, y1, z1), Vec4(x2, y2, z2), Vec4(x3, y3, z3)}, m_color(color) {}
-
-    Triangle(float x1, float y1, float z1, float x2, float y2, float z2, float x3, float y3, float z3, SDL_Color &&color)
-        : m_points{Vec4(x1, y1, z1), Vec4(x2, y2, z2), Vec4(x3, y3, z3)}, m_color(std::move(color)) {}
-
-    Triangle(const Vec4 &p0, const Vec4 &p1, const Vec4 &p2)
-        : m_points{p0, p1, p2}, m_color{0xff, 0xff, 0xff, 0xff} {}
-
-    Triangle(const Vec4 &p0, const Vec4 &p1, const Vec4 &p2, const SDL_Color &color)
-        : m_points{p0, p1, p2}, m_color(color) {}
-
-    Triangle(Vec4 &&p0, Vec4 &&p1, Vec4 &&p2)
-        : m_points{std::move(p0), std::move(p1), std::move(p2)}, m_color{0xff, 0xff, 0xff, 0xff} {}
-
-    Triangle(Vec4 &&p0, Vec4 &&p1, Vec4 &&p2, SDL_Color &color)
-        : m_points{std::move(p0), std::move(p1), std::move(p2)}, m_color(std::move(color)) {}
-
-    Triangle(const Triangle &other)
-        : m_points{other.m_points[0], other.m_points[1], other.m_points[2]}, m_color(other.m_color) {}
-
-    Triangle &operator=(
-        const Triangle &other)
-    {
-        if (this != &other)
-        {
-            m_points[0] = other.m_points[0];
-            m_points[1] = other.m_points[1];
-            m_points[2] = other.m_points[2];
-            m_color = other.m_color;
-        }
+    int first;
+    int count;
+};
 
-        return *this;
-    }
+// A small cluster of neighbouring triangles facing roughly the same way, with
+// bounds for rejecting all of them at once
 
-    const Vec4 &point_at(int index) const { return m_points[index]; }
+struct Meshlet
+{
+    int first_triangle;
+    int triangle_count;
 
-    void set_point_at(int index, const Vec4 &point)
-    {
-        m_points[index] = point;
-    }
+    // Sorted runs of the vertices the triangles use, in the mesh's list of them
 
-    void set_x_on_point_at(int index, float x)
-    {
-        m_points[index].x(x);
-    }
+    int first_vertex_range;
+    int vertex_range_count;
 
-    void set_y_on_point_at(int index, float y)
-    {
-        m_points[index].y(y);
-    }
+    Vec4 min;
+    Vec4 max;
 
-    void set_z_on_point_at(int index, float z)
-    {
-        m_points[index].z(z);
-    }
+    Vec4 center;
+    float radius;
 
-    const SDL_Color &color() const { return m_color; }
+    // Every triangle's normal is within `cone_angle` radians of `cone_axis`
 
-    void set_color(const SDL_Color &color)
-    {
-        m_color = color;
-    }
+    Vec4 cone_axis;
+    float cone_angle;
 
-    static float shortest_distance(
-        const Vec4 &plane_p,
-        const Vec4 &plane_n,
-        const Vec4 &p)
-    {
-        return plane_n.x() * p.x() + plane_n.y() * p.y() + plane_n.z() * p.z() - Vec4::dot_product(plane_n, plane_p);
-    }
+    // True if every triangle faces away from `camera`. The direction to any point
+    // of the bounding sphere is within the sphere's angular size of the direction
+    // to its center, and if that leaves more than `cone_angle` short of a right
+    // angle to the axis, every normal points away too
 
-    static int clip_against_plane(
-        const Vec4 &plane_p,
-        const Vec4 &plane_n,
-        const Triangle &in_tri,
-        Triangle *out_tri1,
-        Triangle *out_tri2)
+    bool is_backfacing(
+        const Vec4 &camera) const
     {
-        // Make sure plane normal is indeed normal
-
-        const auto _plane_n = Vec4::normalize(plane_n);
-
-        // Create two temporary storage arrays to classify points either side of plane
-        // If distance sign is positive, point lies on "inside" of plane
-
-        Vec4 inside_points[3] = {{}, {}, {}};
-        auto inside_point_count = 0;
-
-        Vec4 outside_points[3] = {{}, {}, {}};
-        auto outside_point_count = 0;
-
-        // Get signed distance of each point in triangle to plane
-
-        const auto d0 = Triangle::shortest_distance(plane_p, _plane_n, in_tri.m_points[0]);
-        const auto d1 = Triangle::shortest_distance(plane_p, _plane_n, in_tri.m_points[1]);
-        const auto d2 = Triangle::shortest_distance(plane_p, _plane_n, in_tri.m_points[2]);
-
-        if (d0 >= 0)
-        {
-            inside_points[inside_point_count++] = in_tri.m_points[0];
-        }
-        else
-        {
-            outside_points[outside_point_count++] = in_tri.m_points[0];
-        }
-
-        if (d1 >= 0)
-        {
-            inside_points[inside_point_count++] = in_tri.m_points[1];
-        }
-        else
-        {
-            outside_points[outside_point_count++] = in_tri.m_points[1];
-        }
-
-        if (d2 >= 0)
-        {
-            inside_points[inside_point_count++] = in_tri.m_points[2];
-        }
-        else
-        {
-            outside_points[outside_point_count++] = in_tri.m_points[2];
-        }
-
-        // Now classify triangle points, and break the input triangle into
-        // smaller output triangles if required. There are four possible
-        // outcomes...
-
-        if (inside_point_count == 0)
-        {
-            // All points lie on the outside of plane, so clip whole triangle
-            // It ceases to exist
-
-            return 0; // No returned triangles are valid
-        }
-
-        if (inside_point_count == 3)
-        {
-            // All points lie on the inside of plane, so do nothing
-            // and allow the triangle to simply pass through
-
-            out_tri1->m_color = in_tri.m_color;
+        const auto to_center = Vec4::subtract(center, camera);
 
-            out_tri1->m_points[0] = inside_points[0];
-            out_tri1->m_points[1] = inside_points[1];
-            out_tri1->m_points[2] = inside_points[2];
-
-            return 1; // Just the one returned original triangle is valid
-        }
+        const auto distance = Vec4::length(to_center);
 
-        if (inside_point_count == 1 && outside_point_count == 2)
+        if (distance <= radius)
         {
-            // Triangle should be clipped. As two points lie outside
-            // the plane, the triangle simply becomes a smaller triangle
-
-            // Copy appearance info to new triangle
-
-            out_tri1->m_color = in_tri.m_color;
-
-            // The inside point is valid, so keep that...
-
-            out_tri1->m_points[0] = inside_points[0];
-
-            // but the two new points are at the locations where the
-            // original sides of the triangle (lines) intersect with the plane
-
-            out_tri1->m_points[1] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[0], outside_points[0]);
-            out_tri1->m_points[2] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[0], outside_points[1]);
-
-            return 1; // Return the newly formed single triangle
+            return false;
         }
 
-        if (inside_point_count == 2 && outside_point_count == 1)
-        {
-            // Triangle should be clipped. As two points lie inside the plane,
-            // the clipped triangle becomes a "quad". Fortunately, we can
-            // represent a quad with two new triangles
-
-            // Copy appearance info to new triangles
-
-            out_tri1->m_color = in_tri.m_color;
-            out_tri2->m_color = in_tri.m_color;
-
-            // The first triangle consists of the two inside points and a new
-            // point determined by the location where one side of the triangle
-            // intersects with the plane
-
-            out_tri1->m_points[0] = inside_points[0];
-            out_tri1->m_points[1] = inside_points[1];
-            out_tri1->m_points[2] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[0], outside_points[0]);
+        const auto cos_angle = std::clamp(Vec4::dot_product(to_center, cone_axis) / distance, -1.0f, 1.0f);
 
-            // The second triangle is composed of one of he inside points, a
-            // new point determined by the intersection of the other side of the
-            // triangle and the plane, and the newly created point above
+        const auto angle = std::acos(cos_angle) + std::asin(radius / distance) + cone_angle;
 
-            out_tri2->m_points[0] = inside_points[1];
-            out_tri2->m_points[1] = out_tri1->m_points[2];
-            out_tri2->m_points[2] = Vec4::intersect_plane(plane_p, _plane_n, inside_points[1], outside_points[0]);
+        // A little short of the right angle, for rounding
 
-            return 2; // Return two newly formed triangles which form a quad
-        }
-
-        return 0; // No returned triangles are valid
+        return angle < 3.14159f * 0.5f - 0.001f;
     }
-
-private:
-    Vec4 m_points[3];
-    SDL_Color m_color;
 };
 
 class Mesh
 {
 public:
-    Mesh(const std::vector<Triangle> &triangles)
-        : m_triangles(triangles) {}
-
-    Mesh(std::vector<Triangle> &&triangles)
-        : m_triangles(std::move(triangles)) {}
+    Mesh(
+        const std::vector<Vec4> &vertices,
+        const std::vector<int> &indices,
+        const std::vector<Color> &colors)
+        : m_vertices(vertices), m_indices(indices), m_colors(colors)
+    {
+        build_positions();
 
-    Mesh(const Mesh &other)
-        : m_triangles(other.m_triangles) {}
+        build_normals();
+    }
 
     Mesh(
-        Mesh &&other)
-        : m_triangles(std::move(other.m_triangles)) {}
-
-    Mesh &operator=(
-        const Mesh &other)
+        std::vector<Vec4> &&vertices,
+        std::vector<int> &&indices,
+        std::vector<Color> &&colors)
+        : m_vertices(std::move(vertices)), m_indices(std::move(indices)), m_colors(std::move(colors))
     {
-        if (this != &other)
-        {
-            m_triangles = other.m_triangles;
-        }
+        build_positions();
 
-        return *this;
+        build_normals();
     }
 
     static std::variant<Mesh, Error> load_from_obj_file(
@@ -484,7 +141,9 @@ public:
 
         std::vector<Vec4> vertices;
 
-        std::vector<Triangle> triangles;
+        std::vector<int> indices;
+
+        std::vector<Color> colors;
 
         while (std::getline(file, line))
         {
@@ -508,13 +167,21 @@ public:
 
                 iss >> v1 >> v2 >> v3;
 
-                triangles.push_back(Triangle(vertices[v1 - 1], vertices[v2 - 1], vertices[v3 - 1]));
+                indices.push_back(v1 - 1);
+                indices.push_back(v2 - 1);
+                indices.push_back(v3 - 1);
+
+                colors.push_back(Color{0xff, 0xff, 0xff, 0xff});
             }
         }
 
         file.close();
 
-        return Mesh(triangles);
+        auto mesh = Mesh(std::move(vertices), std::move(indices), std::move(colors));
+
+        mesh.build_meshlets();
+
+        return mesh;
     }
 
     static std::vector<float> generate_height_map(
@@ -534,23 +201,27 @@ public:
         return height_map;
     }
 
-    static SDL_Color color_given_heights(float z1, float z2, float z3)
+    static Color color_given_heights(float z1, float z2, float z3)
     {
         if (z1 == 0 && z2 == 0 && z3 == 0)
         {
-            return SDL_Color{0x00, 0x00, 0xff, 0xcc}; // blue (water)
+            return Color{0x00, 0x00, 0xff, 0xcc}; // blue (water)
         }
 
         if (z1 == 0 || z2 == 0 || z3 == 0)
         {
-            return SDL_Color{0xff, 0xff, 0x70, 0x99}; // yellow (sand)
+            return Color{0xff, 0xff, 0x70, 0x99}; // yellow (sand)
         }
 
-        return SDL_Color{0x00, 0x70, 0x00, 0x99}; // green (grass)
+        return Color{0x00, 0x70, 0x00, 0x99}; // green (grass)
     }
 
+    // Each level after the first is a grid twice as coarse as the one before over
+    // the same vertices, its triangles following on from those of the finer level
+
     static Mesh create_from_height_map(
-        const std::vector<float> &height_map)
+        const std::vector<float> &height_map,
+        int levels = 1)
     {
         const auto height_map_size_f = static_cast<float>(height_map.size());
 
@@ -560,921 +231,4883 @@ public:
 
         const auto stride = stride_plus_one - 1;
 
-        const auto stride_f = static_cast<float>(stride);
-
         ///
 
-        const auto triangles_size = stride * stride * 2;
+        // One vertex per height map sample, shared by every triangle that touches it
 
-        Triangle triangles[triangles_size];
+        std::vector<Vec4> vertices(stride_plus_one * stride_plus_one);
 
-        for (auto z = 0.0f; z < stride_f; ++z)
+        for (auto z = 0; z < stride_plus_one; z++)
         {
-            for (float x = 0; x < stride_f; ++x)
+            for (auto x = 0; x < stride_plus_one; x++)
             {
-                const auto n = static_cast<int>(z * stride_f + x);
-
-                const auto n1 = n * 2;
-
-                const auto n2 = n1 + 1;
+                const auto h = z * stride_plus_one + x;
 
-                const auto h0 = static_cast<int>(z * (stride_f + 1.0f) + x);
+                vertices[h] = Vec4(static_cast<float>(x), height_map[h], static_cast<float>(z));
+            }
+        }
 
-                const auto h1 = h0;
+        ///
 
-                const auto h2 = h1 + 1;
+        auto triangles_size = 0;
 
-                const auto h3 = static_cast<int>((z + 1) * (stride_f + 1.0f) + x);
-                const auto h4 = h3 + 1;
+        for (auto level = 0; level < levels; level++)
+        {
+            const auto cells = stride >> level;
 
-                triangles[n1] = Triangle{x, height_map[h1], z, x, height_map[h3], z + 1.0f, x + 1.0f, height_map[h4], z + 1.0f, Mesh::color_given_heights(height_map[h1], height_map[h3], height_map[h4])};
-                triangles[n2] = Triangle{x, height_map[h1], z, x + 1.0f, height_map[h4], z + 1.0f, x + 1.0f, height_map[h2], z, Mesh::color_given_heights(height_map[h1], height_map[h4], height_map[h2])};
-            }
+            triangles_size += cells * cells * 2;
         }
 
-        ///
+        std::vector<int> indices(triangles_size * 3);
+
+        std::vector<Color> colors(triangles_size);
 
-        std::vector<Triangle> triangles_vec;
+        auto offset = 0;
 
-        for (auto i = 0; i < triangles_size; i++)
+        for (auto level = 0; level < levels; level++)
         {
-            triangles_vec.push_back(triangles[i]);
-        }
+            const auto step = 1 << level;
 
-        ///
+            const auto cells = stride >> level;
 
-        return Mesh(triangles_vec);
-    }
+            for (auto z = 0; z < cells; z++)
+            {
+                for (auto x = 0; x < cells; x++)
+                {
+                    const auto n = z * cells + x;
 
-    const std::vector<Triangle> &triangles() const { return m_triangles; }
+                    const auto n1 = offset + n * 2;
 
-private:
-    std::vector<Triangle> m_triangles;
-};
+                    const auto n2 = n1 + 1;
 
-class Matrix4x4
-{
-public:
-    Matrix4x4(
-        float matrix[4][4])
-        : m_matrix{
-              {matrix[0][0], matrix[0][1], matrix[0][2], matrix[0][3]},
-              {matrix[1][0], matrix[1][1], matrix[1][2], matrix[1][3]},
-              {matrix[2][0], matrix[2][1], matrix[2][2], matrix[2][3]},
-              {matrix[3][0], matrix[3][1], matrix[3][2], matrix[3][3]}} {}
-
-    Matrix4x4()
-        : m_matrix{
-              {0.0f, 0.0f, 0.0f, 0.0f},
-              {0.0f, 0.0f, 0.0f, 0.0f},
-              {0.0f, 0.0f, 0.0f, 0.0f},
-              {0.0f, 0.0f, 0.0f, 0.0f}} {}
-
-    Matrix4x4(
-        float m0, float m1, float m2, float m3,
-        float m4, float m5, float m6, float m7,
-        float m8, float m9, float ma, float mb,
-        float mc, float md, float me, float mf)
-        : m_matrix{
-              {m0, m1, m2, m3},
-              {m4, m5, m6, m7},
-              {m8, m9, ma, mb},
-              {mc, md, me, mf}} {}
-
-    Matrix4x4(
-        const Matrix4x4 &other)
-        : m_matrix{
-              {other.m_matrix[0][0], other.m_matrix[0][1], other.m_matrix[0][2], other.m_matrix[0][3]},
-              {other.m_matrix[1][0], other.m_matrix[1][1], other.m_matrix[1][2], other.m_matrix[1][3]},
-              {other.m_matrix[2][0], other.m_matrix[2][1], other.m_matrix[2][2], other.m_matrix[2][3]},
-              {other.m_matrix[3][0], other.m_matrix[3][1], other.m_matrix[3][2], other.m_matrix[3][3]}} {}
-
-    Matrix4x4(
-        Matrix4x4 &&other)
-        : m_matrix{
-              {std::move(other.m_matrix[0][0]), std::move(other.m_matrix[0][1]), std::move(other.m_matrix[0][2]), std::move(other.m_matrix[0][3])},
-              {std::move(other.m_matrix[1][0]), std::move(other.m_matrix[1][1]), std::move(other.m_matrix[1][2]), std::move(other.m_matrix[1][3])},
-              {std::move(other.m_matrix[2][0]), std::move(other.m_matrix[2][1]), std::move(other.m_matrix[2][2]), std::move(other.m_matrix[2][3])},
-              {std::move(other.m_matrix[3][0]), std::move(other.m_matrix[3][1]), std::move(other.m_matrix[3][2]), std::move(other.m_matrix[3][3])}} {}
-
-    Matrix4x4 &operator=(
-        const Matrix4x4 &other)
-    {
-        if (this != &other)
-        {
-            m_matrix[0][0] = other.m_matrix[0][0];
-            m_matrix[0][1] = other.m_matrix[0][1];
-            m_matrix[0][2] = other.m_matrix[0][2];
-            m_matrix[0][3] = other.m_matrix[0][3];
-
-            m_matrix[1][0] = other.m_matrix[1][0];
-            m_matrix[1][1] = other.m_matrix[1][1];
-            m_matrix[1][2] = other.m_matrix[1][2];
-            m_matrix[1][3] = other.m_matrix[1][3];
-
-            m_matrix[2][0] = other.m_matrix[2][0];
-            m_matrix[2][1] = other.m_matrix[2][1];
-            m_matrix[2][2] = other.m_matrix[2][2];
-            m_matrix[2][3] = other.m_matrix[2][3];
-
-            m_matrix[3][0] = other.m_matrix[3][0];
-            m_matrix[3][1] = other.m_matrix[3][1];
-            m_matrix[3][2] = other.m_matrix[3][2];
-            m_matrix[3][3] = other.m_matrix[3][3];
-        }
-
-        return *this;
-    }
-
-    static Vec4 multiply_vector(
-        const Matrix4x4 &m,
-        const Vec4 &i)
-    {
-        return Vec4(
-            i.x() * m.m_matrix[0][0] + i.y() * m.m_matrix[1][0] + i.z() * m.m_matrix[2][0] + m.m_matrix[3][0],
-            i.x() * m.m_matrix[0][1] + i.y() * m.m_matrix[1][1] + i.z() * m.m_matrix[2][1] + m.m_matrix[3][1],
-            i.x() * m.m_matrix[0][2] + i.y() * m.m_matrix[1][2] + i.z() * m.m_matrix[2][2] + m.m_matrix[3][2],
-            i.x() * m.m_matrix[0][3] + i.y() * m.m_matrix[1][3] + i.z() * m.m_matrix[2][3] + m.m_matrix[3][3]);
-    }
-
-    static Matrix4x4 make_identity()
-    {
-        return Matrix4x4(
-            1.0f, 0.0f, 0.0f, 0.0f,
-            0.0f, 1.0f, 0.0f, 0.0f,
-            0.0f, 0.0f, 1.0f, 0.0f,
-            0.0f, 0.0f, 0.0f, 1.0f);
-    }
-
-    static Matrix4x4 make_rotation_x(
-        float angle_rad)
-    {
-        return Matrix4x4(
-            1.0f, 0.0f, 0.0f, 0.0f,
-            0.0f, std::cos(angle_rad), std::sin(angle_rad), 0.0f,
-            0.0f, -std::sin(angle_rad), std::cos(angle_rad), 0.0f,
-            0.0f, 0.0f, 0.0f, 1.0f);
-    }
-
-    static Matrix4x4 make_rotation_y(
-        float angle_rad)
-    {
-        return Matrix4x4(
-            std::cos(angle_rad), 0.0f, -std::sin(angle_rad), 0.0f,
-            0.0f, 1.0f, 0.0f, 0.0f,
-            std::sin(angle_rad), 0.0f, std::cos(angle_rad), 0.0f,
-            0.0f, 0.0f, 0.0f, 1.0f);
-    }
+                    const auto h1 = z * step * stride_plus_one + x * step;
 
-    static Matrix4x4 make_rotation_z(
-        float angle_rad)
-    {
-        return Matrix4x4(
-            std::cos(angle_rad), std::sin(angle_rad), 0.0f, 0.0f,
-            -std::sin(angle_rad), std::cos(angle_rad), 0.0f, 0.0f,
-            0.0f, 0.0f, 1.0f, 0.0f,
-            0.0f, 0.0f, 0.0f, 1.0f);
-    }
+                    const auto h2 = h1 + step;
 
-    static Matrix4x4 make_translation(
-        float x,
-        float y,
-        float z)
-    {
-        return Matrix4x4(
-            1.0f, 0.0f, 0.0f, 0.0f,
-            0.0f, 1.0f, 0.0f, 0.0f,
-            0.0f, 0.0f, 1.0f, 0.0f,
-            x, y, z, 1.0f);
-    }
+                    const auto h3 = h1 + step * stride_plus_one;
 
-    static Matrix4x4 make_projection(
-        float fov_degrees,
-        float aspect_ratio,
-        float near,
-        float far)
-    {
-        const auto fov_rad = 1.0f / std::tan(fov_degrees * 0.5f / 180.0f * 3.14159f);
+                    const auto h4 = h3 + step;
 
-        return Matrix4x4(
-            aspect_ratio * fov_rad, 0.0f, 0.0f, 0.0f,
-            0.0f, fov_rad, 0.0f, 0.0f,
-            0.0f, 0.0f, far / (far - near), 1.0f,
-            0.0f, 0.0f, (-far * near) / (far - near), 0.0f);
-    }
+                    indices[n1 * 3 + 0] = h1;
+                    indices[n1 * 3 + 1] = h3;
+                    indices[n1 * 3 + 2] = h4;
 
-    static Matrix4x4 multiply(
-        const Matrix4x4 &m1,
-        const Matrix4x4 &m2)
-    {
-        Matrix4x4 matrix;
+                    indices[n2 * 3 + 0] = h1;
+                    indices[n2 * 3 + 1] = h4;
+                    indices[n2 * 3 + 2] = h2;
 
-        for (auto c = 0; c < 4; c++)
-        {
-            for (auto r = 0; r < 4; r++)
-            {
-                matrix.m_matrix[r][c] = m1.m_matrix[r][0] * m2.m_matrix[0][c] + m1.m_matrix[r][1] * m2.m_matrix[1][c] + m1.m_matrix[r][2] * m2.m_matrix[2][c] + m1.m_matrix[r][3] * m2.m_matrix[3][c];
+                    colors[n1] = Mesh::color_given_heights(height_map[h1], height_map[h3], height_map[h4]);
+                    colors[n2] = Mesh::color_given_heights(height_map[h1], height_map[h4], height_map[h2]);
+                }
             }
+
+            offset += cells * cells * 2;
         }
 
-        return matrix;
+        ///
+
+        return Mesh(std::move(vertices), std::move(indices), std::move(colors));
     }
 
-    static Matrix4x4 point_at(
-        const Vec4 &pos,
-        const Vec4 &target,
-        const Vec4 &up)
-    {
-        // Calculate new forward direction
+    const std::vector<Vec4> &vertices() const { return m_vertices; }
 
-        auto new_forward = Vec4::subtract(target, pos);
+    const std::vector<int> &indices() const { return m_indices; }
 
-        new_forward = Vec4::normalize(new_forward);
+    const std::vector<Color> &colors() const { return m_colors; }
 
-        // Calculate new up direction
+    // Vertex positions as separate x/y/z arrays for the batched transform
 
-        const auto a = Vec4::multiply(new_forward, Vec4::dot_product(up, new_forward));
+    const std::vector<float> &xs() const { return m_xs; }
 
-        auto new_up = Vec4::subtract(up, a);
+    const std::vector<float> &ys() const { return m_ys; }
 
-        new_up = Vec4::normalize(new_up);
+    const std::vector<float> &zs() const { return m_zs; }
 
-        // New right direction is easy, its just cross product
+    // Unit normal of each triangle as separate x/y/z arrays, kept up to date with
+    // the vertices
 
-        const auto new_right = Vec4::cross_product(new_up, new_forward);
+    const std::vector<float> &normal_xs() const { return m_normal_xs; }
 
-        // Construct Dimensioning and Translation Matrix
+    const std::vector<float> &normal_ys() const { return m_normal_ys; }
 
-        return Matrix4x4(
-            new_right.x(), new_right.y(), new_right.z(), 0.0f,
-            new_up.x(), new_up.y(), new_up.z(), 0.0f,
-            new_forward.x(), new_forward.y(), new_forward.z(), 0.0f,
-            pos.x(), pos.y(), pos.z(), 1.0f);
-    }
+    const std::vector<float> &normal_zs() const { return m_normal_zs; }
 
-    static Matrix4x4 quick_inverse(
-        const Matrix4x4 &m)
-    {
-        // return Matrix4x4(
-        //     m.m_matrix[0][0], m.m_matrix[1][0], m.m_matrix[2][0], 0.0f,
-        //     m.m_matrix[0][1], m.m_matrix[1][1], m.m_matrix[2][1], 0.0f,
-        //     m.m_matrix[0][2], m.m_matrix[1][2], m.m_matrix[2][2], 0.0f,
-        //     -(m.m_matrix[3][0] * m.m_matrix[0][0] + m.m_matrix[3][1] * m.m_matrix[1][0] + m.m_matrix[3][2] * m.m_matrix[2][0]),
-        //     -(m.m_matrix[3][0] * m.m_matrix[0][1] + m.m_matrix[3][1] * m.m_matrix[1][1] + m.m_matrix[3][2] * m.m_matrix[2][1]),
-        //     -(m.m_matrix[3][0] * m.m_matrix[0][2] + m.m_matrix[3][1] * m.m_matrix[1][2] + m.m_matrix[3][2] * m.m_matrix[2][2]),
-        //     1.0f);
-
-        Matrix4x4 matrix;
-        matrix.m_matrix[0][0] = m.m_matrix[0][0];
-        matrix.m_matrix[0][1] = m.m_matrix[1][0];
-        matrix.m_matrix[0][2] = m.m_matrix[2][0];
-        matrix.m_matrix[0][3] = 0.0f;
-        matrix.m_matrix[1][0] = m.m_matrix[0][1];
-        matrix.m_matrix[1][1] = m.m_matrix[1][1];
-        matrix.m_matrix[1][2] = m.m_matrix[2][1];
-        matrix.m_matrix[1][3] = 0.0f;
-        matrix.m_matrix[2][0] = m.m_matrix[0][2];
-        matrix.m_matrix[2][1] = m.m_matrix[1][2];
-        matrix.m_matrix[2][2] = m.m_matrix[2][2];
-        matrix.m_matrix[2][3] = 0.0f;
-        matrix.m_matrix[3][0] = -(m.m_matrix[3][0] * matrix.m_matrix[0][0] + m.m_matrix[3][1] * matrix.m_matrix[1][0] + m.m_matrix[3][2] * matrix.m_matrix[2][0]);
-        matrix.m_matrix[3][1] = -(m.m_matrix[3][0] * matrix.m_matrix[0][1] + m.m_matrix[3][1] * matrix.m_matrix[1][1] + m.m_matrix[3][2] * matrix.m_matrix[2][1]);
-        matrix.m_matrix[3][2] = -(m.m_matrix[3][0] * matrix.m_matrix[0][2] + m.m_matrix[3][1] * matrix.m_matrix[1][2] + m.m_matrix[3][2] * matrix.m_matrix[2][2]);
-        matrix.m_matrix[3][3] = 1.0f;
-        return matrix;
-    }
+    int triangle_count() const { return static_cast<int>(m_colors.size()); }
 
-private:
-    float m_matrix[4][4];
-};
+    // Clusters of the triangles, empty unless build_meshlets has been called
 
-class Game
-{
-public:
-    Game(
-        int screen_width,
-        int screen_height,
-        int size)
+    const std::vector<Meshlet> &meshlets() const { return m_meshlets; }
+
+    const std::vector<IndexRange> &meshlet_vertex_ranges() const { return m_meshlet_vertex_ranges; }
+
+    // Group the triangles into meshlets and reorder the mesh so each one's
+    // triangles are contiguous, and its vertices mostly so. A meshlet grows from
+    // the first triangle not yet taken, adding whichever neighbour sharing a
+    // vertex with it is closest to facing its way, while any is within 60 degrees
+
+    void build_meshlets()
     {
-        m_screen_width = screen_width;
-        m_screen_height = screen_height;
+        constexpr auto max_triangles = 64;
 
-        m_size = size;
-        m_size_f = static_cast<float>(m_size);
+        constexpr auto min_alignment = 0.5f;
 
-        std::println("creating window");
+        const auto n_triangles = triangle_count();
 
-        m_window = SDL_CreateWindow(
-            "Game",
-            m_screen_width,
-            m_screen_height,
-            SDL_WINDOW_INPUT_FOCUS | SDL_WINDOW_MOUSE_FOCUS | SDL_WINDOW_HIGH_PIXEL_DENSITY);
+        const auto n_vertices = static_cast<int>(m_vertices.size());
 
-        ///
+        // Triangles using each vertex
 
-        int window_size_width, window_size_height, window_size_pixels_width, window_size_pixels_height;
+        std::vector<int> vertex_offsets(n_vertices + 1, 0);
 
-        SDL_GetWindowSize(m_window, &window_size_width, &window_size_height);
+        for (const auto index : m_indices)
+        {
+            vertex_offsets[index + 1]++;
+        }
 
-        SDL_GetWindowSizeInPixels(m_window, &window_size_pixels_width, &window_size_pixels_height);
+        for (auto v = 0; v < n_vertices; v++)
+        {
+            vertex_offsets[v + 1] += vertex_offsets[v];
+        }
 
-        ///
+        std::vector<int> vertex_triangles(m_indices.size());
 
-        m_scale = static_cast<float>(window_size_pixels_width) / static_cast<float>(window_size_width);
+        {
+            auto next = vertex_offsets;
+
+            for (auto i = 0; i < static_cast<int>(m_indices.size()); i++)
+            {
+                vertex_triangles[next[m_indices[i]]++] = static_cast<int>(i / 3);
+            }
+        }
 
         ///
 
-        m_width = static_cast<float>(m_screen_width) * m_scale;
-        m_height = static_cast<float>(m_screen_height) * m_scale;
+        std::vector<bool> is_taken(n_triangles, false);
 
-        ///
+        std::vector<int> order;
 
-        m_renderer = SDL_CreateRenderer(m_window, nullptr);
+        std::vector<int> frontier;
 
-        SDL_SetRenderVSync(m_renderer, SDL_FALSE);
+        std::vector<int> bounds = {0};
 
-        SDL_RaiseWindow(m_window);
+        for (auto seed = 0; seed < n_triangles; seed++)
+        {
+            if (is_taken[seed])
+            {
+                continue;
+            }
 
-        ///
+            auto axis = Vec4(0.0f, 0.0f, 0.0f);
 
-        m_projection_matrix = {};
+            frontier.clear();
 
-        m_camera = {};
-    }
+            frontier.push_back(seed);
 
-    ~Game()
-    {
-        if (m_renderer)
-        {
-            SDL_DestroyRenderer(m_renderer);
-        }
+            for (auto n = 0; n < max_triangles && !frontier.empty(); n++)
+            {
+                // The seed goes in regardless, after that only a neighbour facing
+                // close enough to the meshlet's way
 
-        if (m_window)
-        {
-            SDL_DestroyWindow(m_window);
-        }
-    }
+                auto best = -1;
 
-    void reset_camera()
-    {
-        // m_camera = Vec4(8.0f, 9.51649f, 2.4497957f, 1.0f);
-        // m_camera = Vec4(m_size_f / 2.0f, m_size_f / 4.0f, 0.0f - (m_size_f / 16.0f), 1.0f);
-        // m_camera = Vec4(m_size_f / 2.0f, m_size_f / 4.0f, m_size_f / 32.0f, 1.0f);
-        // m_yaw = 0.0f;
-        // // m_pitch = 0.7708009f;
-        // m_pitch = 0.85f;
-        // m_roll = 0.0f;
+                auto best_alignment = min_alignment;
 
-        // m_camera = Vec4(64.0f, 7.028963f, 10.614152f, 1.0f);
-        // m_yaw = 0.0f;
-        // m_pitch = 0.6240001f;
-        // m_roll = 0.0f;
+                const auto direction = Vec4::normalize(axis);
 
-        // best for 48x48
-        m_camera = Vec4(24.0f, 26.66f, 1.38f, 1.0f);
-        m_yaw = 0.0f;
-        m_pitch = 0.93f;
-        m_roll = 0.0f;
-    }
+                for (auto f = 0; f < static_cast<int>(frontier.size());)
+                {
+                    const auto t = frontier[f];
 
-    void on_create()
-    {
-        m_mesh = Mesh::create_from_height_map(Mesh::generate_height_map(m_size)); // sc2k
-        // m_mesh = Mesh::create_from_height_map(Mesh::generate_height_map(256)); // sc4
+                    if (is_taken[t])
+                    {
+                        frontier[f] = frontier.back();
 
-        m_projection_matrix = Matrix4x4::make_projection(90.0f, m_height / m_width, 0.1f, 1000.0f);
+                        frontier.pop_back();
 
-        ///
+                        continue;
+                    }
 
-        reset_camera();
-    }
+                    const auto alignment = n == 0 ? 1.0f : Vec4::dot_product(Vec4(m_normal_xs[t], m_normal_ys[t], m_normal_zs[t]), direction);
 
-    void print_camera()
-    {
-        std::println("camera = Vec4(x: {0}f, y: {1}f, z: {2}f, w: {3}f);", m_camera.x(), m_camera.y(), m_camera.z(), m_camera.w());
-        std::println("yaw = {0}f;", m_yaw);
-        std::println("pitch = {0}f;", m_pitch);
-        std::println("roll = {0}f;", m_roll);
-        std::println("look direction = Vec4(x: {0}f, y: {1}f, z: {2}f, w: {3}f);", m_look_direction.x(), m_look_direction.y(), m_look_direction.z(), m_look_direction.w());
-        std::println("");
-    }
+                    if (alignment >= best_alignment)
+                    {
+                        best = t;
 
-    void on_update(
-        float elapsed)
-    {
-        const auto c1 = m_camera;
+                        best_alignment = alignment;
+                    }
 
-        const auto yaw_start = m_yaw;
+                    f++;
+                }
 
-        const auto pitch_start = m_pitch;
+                if (best < 0)
+                {
+                    break;
+                }
 
-        const auto roll_start = m_roll;
+                is_taken[best] = true;
 
-        ///
+                order.push_back(best);
 
-        const auto height_ratio = m_camera.y() / (m_size_f / 2.0f);
+                axis = Vec4::add(axis, Vec4(m_normal_xs[best], m_normal_ys[best], m_normal_zs[best]));
 
-        const auto min_speed = 0.125f;
+                for (auto k = 0; k < 3; k++)
+                {
+                    const auto v = m_indices[best * 3 + k];
 
-        const auto move_speed = (height_ratio * (1.0f - min_speed) + min_speed);
+                    for (auto j = vertex_offsets[v]; j < vertex_offsets[v + 1]; j++)
+                    {
+                        if (!is_taken[vertex_triangles[j]])
+                        {
+                            frontier.push_back(vertex_triangles[j]);
+                        }
+                    }
+                }
+            }
+
+            bounds.push_back(static_cast<int>(order.size()));
+        }
 
         ///
 
-        const auto keyboard_state = SDL_GetKeyboardState(nullptr);
+        // Vertices are renumbered in the order the meshlets first use them
 
-        if (keyboard_state[SDL_SCANCODE_UP])
-        {
-            m_camera = Vec4(m_camera.x(), m_camera.y() + (8.0f * elapsed), m_camera.z(), m_camera.w());
-        }
+        std::vector<int> remap(n_vertices, -1);
 
-        if (keyboard_state[SDL_SCANCODE_DOWN])
+        std::vector<Vec4> vertices;
+
+        std::vector<int> indices;
+
+        std::vector<Color> colors;
+
+        for (const auto t : order)
         {
-            m_camera = Vec4(m_camera.x(), m_camera.y() - (8.0f * elapsed), m_camera.z(), m_camera.w());
+            for (auto k = 0; k < 3; k++)
+            {
+                auto &v = remap[m_indices[t * 3 + k]];
+
+                if (v < 0)
+                {
+                    v = static_cast<int>(vertices.size());
+
+                    vertices.push_back(m_vertices[m_indices[t * 3 + k]]);
+                }
+
+                indices.push_back(v);
+            }
+
+            colors.push_back(m_colors[t]);
         }
 
-        ///
+        // Unused vertices go last so nothing refers to them
 
-        if (keyboard_state[SDL_SCANCODE_LEFT])
+        for (auto v = 0; v < n_vertices; v++)
         {
-            m_camera = Vec4(m_camera.x() + (8.0f * elapsed), m_camera.y(), m_camera.z(), m_camera.w());
+            if (remap[v] < 0)
+            {
+                vertices.push_back(m_vertices[v]);
+            }
         }
 
-        if (keyboard_state[SDL_SCANCODE_RIGHT])
+        std::vector<float> normal_xs(n_triangles);
+        std::vector<float> normal_ys(n_triangles);
+        std::vector<float> normal_zs(n_triangles);
+
+        for (auto i = 0; i < n_triangles; i++)
         {
-            m_camera = Vec4(m_camera.x() - (8.0f * elapsed), m_camera.y(), m_camera.z(), m_camera.w());
+            normal_xs[i] = m_normal_xs[order[i]];
+            normal_ys[i] = m_normal_ys[order[i]];
+            normal_zs[i] = m_normal_zs[order[i]];
         }
 
+        m_vertices = std::move(vertices);
+        m_indices = std::move(indices);
+        m_colors = std::move(colors);
+        m_normal_xs = std::move(normal_xs);
+        m_normal_ys = std::move(normal_ys);
+        m_normal_zs = std::move(normal_zs);
+
+        build_positions();
+
         ///
 
-        const auto forward = Vec4::multiply(m_look_direction, std::exp(std::exp(m_pitch) - 1.0f) * 8.0f * elapsed * move_speed);
+        m_meshlets.clear();
 
-        if (keyboard_state[SDL_SCANCODE_W])
-        {
-            const auto w = Vec4::add(m_camera, forward);
+        m_meshlet_vertex_ranges.clear();
 
-            m_camera = Vec4(w.x(), m_camera.y(), w.z(), w.w());
-        }
+        std::vector<int> meshlet_vertices;
 
-        if (keyboard_state[SDL_SCANCODE_S])
+        for (auto m = 0; m + 1 < static_cast<int>(bounds.size()); m++)
         {
-            const auto s = Vec4::subtract(m_camera, forward);
+            Meshlet meshlet;
 
-            m_camera = Vec4(s.x(), m_camera.y(), s.z(), s.w());
-        }
+            meshlet.first_triangle = bounds[m];
+            meshlet.triangle_count = bounds[m + 1] - bounds[m];
 
-        ///
+            meshlet_vertices.assign(m_indices.begin() + meshlet.first_triangle * 3, m_indices.begin() + (meshlet.first_triangle + meshlet.triangle_count) * 3);
 
-        if (keyboard_state[SDL_SCANCODE_Q])
-        {
-            m_yaw += 2.0f * elapsed;
-        }
+            std::sort(meshlet_vertices.begin(), meshlet_vertices.end());
 
-        if (keyboard_state[SDL_SCANCODE_E])
-        {
-            m_yaw -= 2.0f * elapsed;
+            meshlet.first_vertex_range = static_cast<int>(m_meshlet_vertex_ranges.size());
+
+            auto min = m_vertices[meshlet_vertices.front()];
+            auto max = min;
+
+            for (const auto v : meshlet_vertices)
+            {
+                auto &ranges = m_meshlet_vertex_ranges;
+
+                if (static_cast<int>(ranges.size()) > meshlet.first_vertex_range && v <= ranges.back().first + ranges.back().count)
+                {
+                    ranges.back().count = v - ranges.back().first + 1;
+                }
+                else
+                {
+                    ranges.push_back(IndexRange{v, 1});
+                }
+
+                const auto &p = m_vertices[v];
+
+                min = Vec4(std::min(min.x(), p.x()), std::min(min.y(), p.y()), std::min(min.z(), p.z()));
+                max = Vec4(std::max(max.x(), p.x()), std::max(max.y(), p.y()), std::max(max.z(), p.z()));
+            }
+
+            meshlet.vertex_range_count = static_cast<int>(m_meshlet_vertex_ranges.size()) - meshlet.first_vertex_range;
+
+            meshlet.min = min;
+            meshlet.max = max;
+
+            meshlet.center = Vec4((min.x() + max.x()) * 0.5f, (min.y() + max.y()) * 0.5f, (min.z() + max.z()) * 0.5f);
+
+            meshlet.radius = 0.0f;
+
+            for (const auto v : meshlet_vertices)
+            {
+                meshlet.radius = std::max(meshlet.radius, Vec4::distance(m_vertices[v], meshlet.center));
+            }
+
+            // The cone's axis is the average normal, a meshlet with a degenerate
+            // triangle or normals cancelling out gets a cone that culls nothing
+
+            auto axis = Vec4(0.0f, 0.0f, 0.0f);
+
+            for (auto i = meshlet.first_triangle; i < meshlet.first_triangle + meshlet.triangle_count; i++)
+            {
+                axis = Vec4::add(axis, Vec4(m_normal_xs[i], m_normal_ys[i], m_normal_zs[i]));
+            }
+
+            meshlet.cone_axis = Vec4::normalize(axis);
+
+            meshlet.cone_angle = 0.0f;
+
+            for (auto i = meshlet.first_triangle; i < meshlet.first_triangle + meshlet.triangle_count; i++)
+            {
+                const auto alignment = Vec4::dot_product(Vec4(m_normal_xs[i], m_normal_ys[i], m_normal_zs[i]), meshlet.cone_axis);
+
+                meshlet.cone_angle = std::max(meshlet.cone_angle, std::acos(std::clamp(alignment, -1.0f, 1.0f)));
+            }
+
+            if (!std::isfinite(Vec4::length(meshlet.cone_axis)))
+            {
+                meshlet.cone_angle = 3.14159f;
+            }
+
+            m_meshlets.push_back(meshlet);
         }
 
-        ///
+        m_revision++;
+    }
 
-        const auto up = Vec4(0.0f, 1.0f, 0.0f, 1.0f);
+    // Bumped whenever the meshlets are rebuilt, so anything derived from the mesh
+    // can tell it is stale. Vertices are fixed once the mesh is built
 
-        const auto direction = Vec4::cross_product(up, forward);
+    int revision() const { return m_revision; }
 
-        ///
+    // Each triangle's colour lit by a directional light in model space. Only relit
+    // when the light or the mesh has changed since the last call
 
-        if (keyboard_state[SDL_SCANCODE_A])
+    const std::vector<Color> &lit_colors(
+        const Vec4 &light_direction)
+    {
+        const auto is_same_light =
+            light_direction.x() == m_lit_direction.x() &&
+            light_direction.y() == m_lit_direction.y() &&
+            light_direction.z() == m_lit_direction.z();
+
+        if (m_lit_revision == m_revision && is_same_light)
         {
-            m_camera = Vec4(m_camera.x() + direction.x(), m_camera.y(), m_camera.z() + direction.z(), m_camera.w());
+            return m_lit_colors;
         }
 
-        if (keyboard_state[SDL_SCANCODE_D])
+        m_lit_colors.resize(m_colors.size());
+
+        for (auto i = 0; i < triangle_count(); i++)
         {
-            m_camera = Vec4(m_camera.x() - direction.x(), m_camera.y(), m_camera.z() - direction.z(), m_camera.w());
+            m_lit_colors[i] = light_color(m_colors[i], Vec4(m_normal_xs[i], m_normal_ys[i], m_normal_zs[i]), light_direction);
         }
 
-        ///
+        m_lit_direction = light_direction;
 
-        if (keyboard_state[SDL_SCANCODE_T])
+        m_lit_revision = m_revision;
+
+        return m_lit_colors;
+    }
+
+    // Mix of two colours, all of `from` at 0 and all of `to` at 1
+
+    static Color blend_color(
+        const Color &from,
+        const Color &to,
+        float t)
+    {
+        const auto mix = [t](uint8_t a, uint8_t b)
         {
-            m_camera = Vec4::add(m_camera, forward);
-            m_camera = Vec4(m_camera.x(), m_camera.y() - (8.0f * elapsed), m_camera.z(), m_camera.w());
-        }
+            return static_cast<uint8_t>(std::lround(a + (b - a) * t));
+        };
 
-        if (keyboard_state[SDL_SCANCODE_G])
+        return Color{mix(from.r, to.r), mix(from.g, to.g), mix(from.b, to.b), mix(from.a, to.a)};
+    }
+
+    // Shade a colour by how "aligned" the light direction and the surface normal
+    // are, never below a tenth so unlit faces still show
+
+    static Color light_color(
+        const Color &color,
+        const Vec4 &normal,
+        const Vec4 &light_direction)
+    {
+        const auto dp = std::max(0.1f, Vec4::dot_product(normal, light_direction));
+
+        return Color{static_cast<uint8_t>(color.r * dp),
+                     static_cast<uint8_t>(color.g * dp),
+                     static_cast<uint8_t>(color.b * dp),
+                     color.a};
+    }
+
+private:
+    void build_positions()
+    {
+        m_xs.resize(m_vertices.size());
+        m_ys.resize(m_vertices.size());
+        m_zs.resize(m_vertices.size());
+
+        for (auto i = 0; i < static_cast<int>(m_vertices.size()); i++)
         {
-            m_camera = Vec4::subtract(m_camera, forward);
-            m_camera = Vec4(m_camera.x(), m_camera.y() + (8.0f * elapsed), m_camera.z(), m_camera.w());
+            m_xs[i] = m_vertices[i].x();
+            m_ys[i] = m_vertices[i].y();
+            m_zs[i] = m_vertices[i].z();
         }
+    }
 
-        ///
+    // Get lines either side of each triangle, then take their cross product and
+    // normalise it for every triangle at once with the batched kernels
 
-        if (keyboard_state[SDL_SCANCODE_U])
+    void build_normals()
+    {
+        const auto n = triangle_count();
+
+        std::vector<float> edges[6];
+
+        for (auto &it : edges)
         {
-            m_pitch -= 2.0f * elapsed;
+            it.resize(n);
         }
 
-        if (keyboard_state[SDL_SCANCODE_J])
+        for (auto i = 0; i < n; i++)
         {
-            m_pitch += 2.0f * elapsed;
+            const auto &p0 = m_vertices[m_indices[i * 3 + 0]];
+            const auto &p1 = m_vertices[m_indices[i * 3 + 1]];
+            const auto &p2 = m_vertices[m_indices[i * 3 + 2]];
+
+            const auto a = Vec4::subtract(p1, p0);
+            const auto b = Vec4::subtract(p2, p0);
+
+            edges[0][i] = a.x();
+            edges[1][i] = a.y();
+            edges[2][i] = a.z();
+            edges[3][i] = b.x();
+            edges[4][i] = b.y();
+            edges[5][i] = b.z();
         }
 
-        m_pitch = std::min(std::max(0.0f, m_pitch), 1.5f);
+        m_normal_xs.resize(n);
+        m_normal_ys.resize(n);
+        m_normal_zs.resize(n);
 
-        ///
+        const auto &kernels = MathBackend::kernels();
 
-        if (m_camera.y() < 0.5f)
-        {
-            m_camera = Vec4(m_camera.x(), 0.5f, m_camera.z(), m_camera.w());
-        }
+        kernels.cross_product(edges[0].data(), edges[1].data(), edges[2].data(), edges[3].data(), edges[4].data(), edges[5].data(), m_normal_xs.data(), m_normal_ys.data(), m_normal_zs.data(), n);
 
-        ///
+        kernels.normalize(m_normal_xs.data(), m_normal_ys.data(), m_normal_zs.data(), n);
+    }
 
-        if (c1.x() != m_camera.x() || c1.y() != m_camera.y() || c1.z() != m_camera.z() || c1.w() != m_camera.w() || yaw_start != m_yaw || pitch_start != m_pitch || roll_start != m_roll)
-        {
-            // std::println("camera = Vec4(x: {0}f, y: {1}f, z: {2}f, w: {3}f);", m_camera.x(), m_camera.y(), m_camera.z(), m_camera.w());
-            // std::println("yaw = {0}f;", m_yaw);
-            // std::println("pitch = {0}f;", m_pitch);
-            // std::println("roll = {0}f;", m_roll);
-            // std::println("look direction = Vec4(x: {0}f, y: {1}f, z: {2}f, w: {3}f);", m_look_direction.x(), m_look_direction.y(), m_look_direction.z(), m_look_direction.w());
-            // std::println("");
-            print_camera();
-        }
+    std::vector<Vec4> m_vertices;
+    std::vector<int> m_indices;
+    std::vector<Color> m_colors;
+    std::vector<float> m_xs;
+    std::vector<float> m_ys;
+    std::vector<float> m_zs;
+    std::vector<float> m_normal_xs;
+    std::vector<float> m_normal_ys;
+    std::vector<float> m_normal_zs;
+    std::vector<Color> m_lit_colors;
+    Vec4 m_lit_direction;
+    int m_lit_revision = -1;
+    std::vector<Meshlet> m_meshlets;
+    std::vector<IndexRange> m_meshlet_vertex_ranges;
+    int m_revision = 0;
+};
 
-        ///
+// Clips triangles in homogeneous clip space, before the perspective divide, against
+// the near and far planes and a guard band around the screen. Every vertex carries
+// a 6 bit outcode against the screen and another against the guard band, so only
+// triangles that straddle a plane do any clipping work
 
-        const auto rotation_z = Matrix4x4::make_rotation_z(m_theta * 0.5f);
+class ClipSpaceClipper
+{
+public:
+    // Guard band half extent in normalized device coordinates, one screen beyond each edge
 
-        const auto rotation_x = Matrix4x4::make_rotation_x(m_theta);
+    static constexpr float guard_band = 3.0f;
 
-        ///
+    // Clipping a triangle against six planes adds at most one vertex per plane
 
-        const auto translation = Matrix4x4::make_translation(0.0f, 0.0f, 10.0f); // TODO: explore diff values?
+    static constexpr int max_vertices = 9;
 
-        auto world = Matrix4x4::make_identity();
-        world = Matrix4x4::multiply(rotation_z, rotation_x);
-        world = Matrix4x4::multiply(world, translation);
+    struct Stats
+    {
+        int accepted = 0;
+        int rejected = 0;
+        int clipped = 0;
+    };
+
+    // Rejects triangles entirely beyond one screen plane and accepts those inside
+    // the guard band, for up to 8 triangles of `order` at once. Each triangle's
+    // outcodes go in a byte lane of a 64 bit word, so one AND or OR tests all of
+    // them, and bit k of the masks returned is set for `order[k]`. Triangles in
+    // neither mask need `clip`
+
+    struct BatchResult
+    {
+        uint32_t rejected;
+        uint32_t accepted;
+    };
+
+    BatchResult test_batch(
+        const uint8_t *screen_codes,
+        const uint8_t *guard_codes,
+        const int *indices,
+        const int *order,
+        int count)
+    {
+        uint64_t screen[3] = {};
+        uint64_t guard[3] = {};
 
-        ///
+        for (auto k = 0; k < count; k++)
+        {
+            const auto *triangle = indices + order[k] * 3;
+
+            for (auto v = 0; v < 3; v++)
+            {
+                screen[v] |= static_cast<uint64_t>(screen_codes[triangle[v]]) << (8 * k);
+                guard[v] |= static_cast<uint64_t>(guard_codes[triangle[v]]) << (8 * k);
+            }
+        }
 
-        auto target = Vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        const auto lanes = (1u << count) - 1u;
 
-        const auto camera_rotation = Matrix4x4::multiply(Matrix4x4::multiply(Matrix4x4::make_rotation_x(m_pitch), Matrix4x4::make_rotation_y(m_yaw)), Matrix4x4::make_rotation_z(m_roll));
+        const auto rejected = nonzero_lanes(screen[0] & screen[1] & screen[2]) & lanes;
+        const auto accepted = ~nonzero_lanes(guard[0] | guard[1] | guard[2]) & ~rejected & lanes;
 
-        m_look_direction = Matrix4x4::multiply_vector(camera_rotation, target);
+        m_stats.rejected += std::popcount(rejected);
+        m_stats.accepted += std::popcount(accepted);
 
-        target = Vec4::add(m_camera, m_look_direction);
+        return BatchResult{rejected, accepted};
+    }
 
-        const auto camera = Matrix4x4::point_at(m_camera, target, up);
+    // Sutherland-Hodgman against each guard band plane in `planes`, returns the
+    // number of polygon vertices left
 
-        const auto view = Matrix4x4::quick_inverse(camera);
+    int clip(
+        const Vec4 &p0,
+        const Vec4 &p1,
+        const Vec4 &p2,
+        int planes,
+        Vec4 (&polygon)[max_vertices])
+    {
+        Vec4 scratch[max_vertices];
 
-        std::vector<Triangle> triangles;
+        Vec4 *in = polygon;
 
-        if (m_mesh.has_value())
+        Vec4 *out = scratch;
+
+        in[0] = p0;
+        in[1] = p1;
+        in[2] = p2;
+
+        auto count = 3;
+
+        for (auto plane = 0; plane < 6 && count > 0; plane++)
         {
-            for (auto i = 0; i < m_mesh->triangles().size(); i++)
+            if ((planes & (1 << plane)) == 0)
             {
-                auto tri = m_mesh->triangles()[i];
+                continue;
+            }
 
-                // World Matrix Transform
+            count = clip_plane(in, count, out, plane);
 
-                auto tri_transformed = Triangle{};
+            std::swap(in, out);
+        }
 
-                tri_transformed.set_point_at(0, Matrix4x4::multiply_vector(world, tri.point_at(0)));
+        if (in != polygon)
+        {
+            std::copy(in, in + count, polygon);
+        }
 
-                // if transformed is not a certain distance of `m_camera` or within 90 degrees of direction, skip
+        if (count < 3)
+        {
+            m_stats.rejected++;
 
-                // if (Vec4::dot_product(Vec4::normalize(Vec4::subtract(tri_transformed.point_at(0), m_camera)), Vec4::normalize(m_look_direction)) < 0.725f)
+            return 0;
+        }
 
-                // if (Vec4::dot_product(Vec4::normalize(Vec4::subtract(tri_transformed.point_at(0), m_camera)), Vec4::normalize(m_look_direction)) < 0.775f)
-                // {
-                //     continue;
-                // }
+        m_stats.clipped++;
 
-                // if (Vec4::distance(tri_transformed.point_at(0), m_camera) > (50.0f + (m_camera.y() * 4.0f)))
-                if (Vec4::distance(tri_transformed.point_at(0), m_camera) > (75.0f + (m_camera.y() * 2.0f)))
-                {
-                    continue;
-                }
+        return count;
+    }
 
+    const Stats &stats() const { return m_stats; }
 
-                ///
+private:
+    // One bit per non-zero byte. Outcodes fit in 6 bits, so adding 0x7f to a
+    // byte sets its top bit without carrying into the next, and the multiply
+    // gathers the top bits into the highest byte
 
-                auto tri_projected = Triangle{};
+    static uint32_t nonzero_lanes(
+        uint64_t bytes)
+    {
+        const auto high = (bytes + 0x7f7f7f7f7f7f7f7full) & 0x8080808080808080ull;
 
-                auto tri_viewed = Triangle{};
+        return static_cast<uint32_t>(((high >> 7) * 0x0102040810204080ull) >> 56);
+    }
 
-                // World Matrix Transform (cont.)
+    // Signed distance to a plane, positive on the inside
 
-                tri_transformed.set_point_at(1, Matrix4x4::multiply_vector(world, tri.point_at(1)));
-                tri_transformed.set_point_at(2, Matrix4x4::multiply_vector(world, tri.point_at(2)));
-                tri_transformed.set_color(tri.color());
+    static float distance(
+        const Vec4 &p,
+        int plane)
+    {
+        switch (plane)
+        {
+        case 0:
+            return p.x() + guard_band * p.w();
+        case 1:
+            return guard_band * p.w() - p.x();
+        case 2:
+            return p.y() + guard_band * p.w();
+        case 3:
+            return guard_band * p.w() - p.y();
+        case 4:
+            return p.z();
+        default:
+            return p.w() - p.z();
+        }
+    }
 
-                // Calculate triangle Normal
-                // Get lines either side of triangle
+    static int clip_plane(
+        const Vec4 *in,
+        int count,
+        Vec4 *out,
+        int plane)
+    {
+        auto n = 0;
 
-                const auto line1 = Vec4::subtract(tri_transformed.point_at(1), tri_transformed.point_at(0));
-                const auto line2 = Vec4::subtract(tri_transformed.point_at(2), tri_transformed.point_at(0));
+        auto previous = in[count - 1];
 
-                // Take cross product of lines to get normal to triangle surface
+        auto previous_distance = distance(previous, plane);
 
-                auto normal = Vec4::cross_product(line1, line2);
+        for (auto i = 0; i < count; i++)
+        {
+            const auto &current = in[i];
 
-                // You normally need to normalise a normal!
+            const auto current_distance = distance(current, plane);
 
-                normal = Vec4::normalize(normal);
+            if ((previous_distance >= 0.0f) != (current_distance >= 0.0f))
+            {
+                const auto t = previous_distance / (previous_distance - current_distance);
 
-                // Get Ray from triangle to camera
+                out[n++] = Vec4(
+                    previous.x() + (current.x() - previous.x()) * t,
+                    previous.y() + (current.y() - previous.y()) * t,
+                    previous.z() + (current.z() - previous.z()) * t,
+                    previous.w() + (current.w() - previous.w()) * t);
+            }
 
-                const auto camera_ray = Vec4::subtract(tri_transformed.point_at(0), m_camera);
+            if (current_distance >= 0.0f)
+            {
+                out[n++] = current;
+            }
 
-                // If ray is aligned with normal, then triangle is visible
+            previous = current;
 
-                if (Vec4::dot_product(normal, camera_ray) < 0.0f)
-                {
-                    // Illumination
+            previous_distance = current_distance;
+        }
+
+        return n;
+    }
+
+    Stats m_stats;
+};
+
+class VertexBatch
+{
+public:
+    void clear()
+    {
+        resize(0);
+    }
+
+    void resize(
+        int n)
+    {
+        m_clip_x.resize(n);
+        m_clip_y.resize(n);
+        m_clip_z.resize(n);
+        m_clip_w.resize(n);
+        m_screen_x.resize(n);
+        m_screen_y.resize(n);
+        m_screen_z.resize(n);
+        m_screen_codes.resize(n);
+        m_guard_codes.resize(n);
+    }
+
+    int size() const { return static_cast<int>(m_screen_x.size()); }
+
+    // Model Space --> Clip Space --> Screen Space for `count` vertices in one pass,
+    // using a single fused world * view * projection matrix
+
+    void transform(
+        const Matrix4x4 &world_view_projection,
+        const float *xs,
+        const float *ys,
+        const float *zs,
+        int first,
+        int count,
+        float width,
+        float height)
+    {
+        MathBackend::kernels().transform(
+            world_view_projection,
+            xs + first, ys + first, zs + first,
+            m_clip_x.data() + first, m_clip_y.data() + first, m_clip_z.data() + first, m_clip_w.data() + first,
+            m_screen_x.data() + first, m_screen_y.data() + first, m_screen_z.data() + first,
+            count,
+            0.5f * width,
+            0.5f * height);
+    }
+
+    // Outcodes of `count` transformed vertices against the screen and the guard band
+
+    void classify(
+        int first,
+        int count)
+    {
+        MathBackend::kernels().outcodes(
+            m_clip_x.data() + first, m_clip_y.data() + first, m_clip_z.data() + first, m_clip_w.data() + first,
+            m_screen_codes.data() + first, m_guard_codes.data() + first,
+            count,
+            ClipSpaceClipper::guard_band);
+    }
+
+    int push_clip(
+        const Vec4 &clip,
+        float width,
+        float height)
+    {
+        const auto inv_w = 1.0f / clip.w();
+
+        return push(
+            clip,
+            Vec4(
+                (1.0f - clip.x() * inv_w) * 0.5f * width,
+                (1.0f - clip.y() * inv_w) * 0.5f * height,
+                clip.z() * inv_w));
+    }
+
+    int push_screen(
+        const Vec4 &screen)
+    {
+        return push(Vec4(0.0f, 0.0f, 0.0f, 1.0f), screen);
+    }
+
+    const float *clip_z() const { return m_clip_z.data(); }
+
+    const uint8_t *screen_codes() const { return m_screen_codes.data(); }
+
+    const uint8_t *guard_codes() const { return m_guard_codes.data(); }
+
+    Vec4 clip_point(int index) const
+    {
+        return Vec4(m_clip_x[index], m_clip_y[index], m_clip_z[index], m_clip_w[index]);
+    }
+
+    const float *screen_x() const { return m_screen_x.data(); }
+
+    const float *screen_y() const { return m_screen_y.data(); }
+
+    const float *screen_z() const { return m_screen_z.data(); }
+
+    Vec4 screen_point(int index) const
+    {
+        return Vec4(m_screen_x[index], m_screen_y[index], m_screen_z[index]);
+    }
+
+    // Add another batch's vertices after these ones
+
+    void append(
+        const VertexBatch &other)
+    {
+        m_clip_x.insert(m_clip_x.end(), other.m_clip_x.begin(), other.m_clip_x.end());
+        m_clip_y.insert(m_clip_y.end(), other.m_clip_y.begin(), other.m_clip_y.end());
+        m_clip_z.insert(m_clip_z.end(), other.m_clip_z.begin(), other.m_clip_z.end());
+        m_clip_w.insert(m_clip_w.end(), other.m_clip_w.begin(), other.m_clip_w.end());
+        m_screen_x.insert(m_screen_x.end(), other.m_screen_x.begin(), other.m_screen_x.end());
+        m_screen_y.insert(m_screen_y.end(), other.m_screen_y.begin(), other.m_screen_y.end());
+        m_screen_z.insert(m_screen_z.end(), other.m_screen_z.begin(), other.m_screen_z.end());
+        m_screen_codes.insert(m_screen_codes.end(), other.m_screen_codes.begin(), other.m_screen_codes.end());
+        m_guard_codes.insert(m_guard_codes.end(), other.m_guard_codes.begin(), other.m_guard_codes.end());
+    }
+
+private:
+    int push(
+        const Vec4 &clip,
+        const Vec4 &screen)
+    {
+        m_clip_x.push_back(clip.x());
+        m_clip_y.push_back(clip.y());
+        m_clip_z.push_back(clip.z());
+        m_clip_w.push_back(clip.w());
+        m_screen_x.push_back(screen.x());
+        m_screen_y.push_back(screen.y());
+        m_screen_z.push_back(screen.z());
+        m_screen_codes.push_back(0);
+        m_guard_codes.push_back(0);
+
+        return static_cast<int>(m_screen_x.size()) - 1;
+    }
+
+
+    std::vector<float> m_clip_x;
+    std::vector<float> m_clip_y;
+    std::vector<float> m_clip_z;
+    std::vector<float> m_clip_w;
+    std::vector<float> m_screen_x;
+    std::vector<float> m_screen_y;
+    std::vector<float> m_screen_z;
+    std::vector<uint8_t> m_screen_codes;
+    std::vector<uint8_t> m_guard_codes;
+};
+
+class Frustum
+{
+public:
+    enum class Containment
+    {
+        outside,
+        intersecting,
+        inside
+    };
+
+    // Extract the six clip planes from a combined model * view * projection matrix,
+    // each plane is a Vec4 (a, b, c, d) in model space where a * x + b * y + c * z + d >= 0
+    // is the visible side
+
+    static Frustum from_matrix(
+        const Matrix4x4 &m)
+    {
+        const auto column = [&m](int c) -> Vec4
+        { return Vec4(m.at(0, c), m.at(1, c), m.at(2, c), m.at(3, c)); };
+
+        const auto cx = column(0);
+        const auto cy = column(1);
+        const auto cz = column(2);
+        const auto cw = column(3);
+
+        const auto add = [](const Vec4 &a, const Vec4 &b) -> Vec4
+        { return Vec4(a.x() + b.x(), a.y() + b.y(), a.z() + b.z(), a.w() + b.w()); };
+
+        const auto sub = [](const Vec4 &a, const Vec4 &b) -> Vec4
+        { return Vec4(a.x() - b.x(), a.y() - b.y(), a.z() - b.z(), a.w() - b.w()); };
+
+        Frustum frustum;
+
+        frustum.m_planes[0] = add(cw, cx); // left
+        frustum.m_planes[1] = sub(cw, cx); // right
+        frustum.m_planes[2] = add(cw, cy); // bottom
+        frustum.m_planes[3] = sub(cw, cy); // top
+        frustum.m_planes[4] = cz;          // near, clip z runs from 0 to w
+        frustum.m_planes[5] = sub(cw, cz); // far
+
+        return frustum;
+    }
+
+    // Test an axis aligned box using the corner furthest along (and against) each plane normal
+
+    Containment test_box(
+        const Vec4 &min,
+        const Vec4 &max) const
+    {
+        auto result = Containment::inside;
+
+        for (const auto &plane : m_planes)
+        {
+            const auto px = plane.x() >= 0.0f ? max.x() : min.x();
+            const auto py = plane.y() >= 0.0f ? max.y() : min.y();
+            const auto pz = plane.z() >= 0.0f ? max.z() : min.z();
+
+            if (plane.x() * px + plane.y() * py + plane.z() * pz + plane.w() < 0.0f)
+            {
+                return Containment::outside;
+            }
+
+            const auto nx = plane.x() >= 0.0f ? min.x() : max.x();
+            const auto ny = plane.y() >= 0.0f ? min.y() : max.y();
+            const auto nz = plane.z() >= 0.0f ? min.z() : max.z();
+
+            if (plane.x() * nx + plane.y() * ny + plane.z() * nz + plane.w() < 0.0f)
+            {
+                result = Containment::intersecting;
+            }
+        }
+
+        return result;
+    }
+
+private:
+    Vec4 m_planes[6];
+};
+
+// The camera's view and projection, kept between frames and only recomputed
+// when the pose, projection or world matrix they come from changes. Culling and
+// lighting work in model space, so it also keeps the camera position and the
+// frustum planes brought into model space, along with the single matrix that
+// takes vertices from model space to clip space
+
+class Camera
+{
+public:
+    void set_pose(
+        const Vec4 &position,
+        float yaw,
+        float pitch,
+        float roll)
+    {
+        if (position.x() == m_position.x() && position.y() == m_position.y() && position.z() == m_position.z() &&
+            yaw == m_yaw && pitch == m_pitch && roll == m_roll)
+        {
+            return;
+        }
+
+        m_position = Vec4(position.x(), position.y(), position.z(), 1.0f);
+        m_yaw = yaw;
+        m_pitch = pitch;
+        m_roll = roll;
+
+        m_is_view_dirty = true;
+    }
+
+    void set_projection(
+        float fov_degrees,
+        float aspect_ratio,
+        float near,
+        float far)
+    {
+        if (fov_degrees == m_fov_degrees && aspect_ratio == m_aspect_ratio && near == m_near && far == m_far)
+        {
+            return;
+        }
+
+        m_fov_degrees = fov_degrees;
+        m_aspect_ratio = aspect_ratio;
+        m_near = near;
+        m_far = far;
+
+        m_is_projection_dirty = true;
+    }
+
+    void set_world(
+        const Matrix4x4 &world)
+    {
+        for (auto r = 0; r < 4; r++)
+        {
+            for (auto c = 0; c < 4; c++)
+            {
+                if (world.at(r, c) != m_world.at(r, c))
+                {
+                    m_world = world;
+
+                    m_is_world_dirty = true;
+
+                    return;
+                }
+            }
+        }
+    }
+
+    // Recompute whatever the changes since the last update affect, and count a
+    // new revision if anything did
+
+    void update()
+    {
+        if (!m_is_view_dirty && !m_is_projection_dirty && !m_is_world_dirty)
+        {
+            return;
+        }
+
+        if (m_is_view_dirty)
+        {
+            const auto up = Vec4(0.0f, 1.0f, 0.0f, 1.0f);
+
+            // Only the look direction needs the camera's rotation, so the forward axis
+            // goes through each rotation instead of building their product
+
+            m_look_direction = Matrix4x4::transform(Vec4(0.0f, 0.0f, 1.0f, 1.0f), Matrix4x4::make_rotation_x(m_pitch), Matrix4x4::make_rotation_y(m_yaw), Matrix4x4::make_rotation_z(m_roll));
+
+            const auto target = Vec4::add(m_position, m_look_direction);
+
+            m_view = Matrix4x4::quick_inverse(Matrix4x4::point_at(m_position, target, up));
+        }
+
+        if (m_is_projection_dirty)
+        {
+            m_projection = Matrix4x4::make_projection(m_fov_degrees, m_aspect_ratio, m_near, m_far);
+        }
+
+        if (m_is_world_dirty)
+        {
+            m_inverse_world = Matrix4x4::quick_inverse(m_world);
+        }
+
+        if (m_is_view_dirty || m_is_world_dirty)
+        {
+            m_model_position = Matrix4x4::multiply_vector(m_inverse_world, m_position);
+        }
+
+        // View and projection are only kept for this, fused from all three each
+        // time as a cached view projection would round differently and move the
+        // odd pixel along triangle edges
+
+        m_world_view_projection = Matrix4x4::multiply(m_world, m_view, m_projection);
+
+        m_frustum = Frustum::from_matrix(m_world_view_projection);
+
+        m_is_view_dirty = false;
+        m_is_projection_dirty = false;
+        m_is_world_dirty = false;
+
+        m_revision++;
+    }
+
+    int revision() const { return m_revision; }
+
+    const Vec4 &look_direction() const { return m_look_direction; }
+
+    const Matrix4x4 &inverse_world() const { return m_inverse_world; }
+
+    const Matrix4x4 &world_view_projection() const { return m_world_view_projection; }
+
+    const Vec4 &model_position() const { return m_model_position; }
+
+    const Frustum &frustum() const { return m_frustum; }
+
+private:
+    Vec4 m_position;
+    float m_yaw = 0.0f;
+    float m_pitch = 0.0f;
+    float m_roll = 0.0f;
+
+    float m_fov_degrees = 0.0f;
+    float m_aspect_ratio = 0.0f;
+    float m_near = 0.0f;
+    float m_far = 0.0f;
+
+    Matrix4x4 m_world = Matrix4x4::make_identity();
+
+    bool m_is_view_dirty = true;
+    bool m_is_projection_dirty = true;
+    bool m_is_world_dirty = true;
+
+    int m_revision = 0;
+
+    Vec4 m_look_direction = Vec4(0.0f, 0.0f, 1.0f, 1.0f);
+    Matrix4x4 m_view;
+    Matrix4x4 m_projection;
+    Matrix4x4 m_inverse_world;
+    Matrix4x4 m_world_view_projection;
+    Vec4 m_model_position;
+    Frustum m_frustum;
+};
+
+struct TerrainNode
+{
+    // Tile bounds [x0, x1) x [z0, z1), clipped to the map
+
+    int x0;
+    int z0;
+    int x1;
+    int z1;
+    int size; // before clipping, children split the node at half of this
+    float min_height;
+    float max_height;
+    int children[4];
+};
+
+// Quadtree of fixed size chunks over a height map mesh, used to reject whole
+// regions of terrain before any per vertex work is done
+
+class Terrain
+{
+public:
+    static constexpr int chunk_size = 16;
+
+    // Occluders are a chunk's lowest point over blocks of this many tiles a side,
+    // small enough to follow the shape of a hill
+
+    static constexpr int block_size = 4;
+
+    // Chunks further away are drawn from grids stepping over 2, 4, 8 and then 16
+    // tiles, the last being a single cell per chunk
+
+    static constexpr int lod_levels = 5;
+
+    // Chunks nearer than this are drawn at full detail, each coarser level reaches
+    // twice as far as the one before it. Every level has to cover more than a
+    // chunk's diagonal, and then as much again to morph over
+
+    static constexpr float lod_distance = 64.0f;
+
+    static_assert(lod_distance > 2.0f * 1.415f * chunk_size);
+
+    static Terrain create_from_height_map(
+        const std::vector<float> &height_map)
+    {
+        const auto stride_plus_one = static_cast<int>(std::sqrt(static_cast<float>(height_map.size())));
+
+        Terrain terrain;
+
+        terrain.m_stride = stride_plus_one - 1;
+
+        // Round the root up to a power of two number of chunks, nodes beyond the
+        // edge of the map are never created
+
+        auto root_size = chunk_size;
+
+        while (root_size < terrain.m_stride)
+        {
+            root_size *= 2;
+        }
+
+        terrain.m_root = terrain.build(height_map, 0, 0, root_size);
+
+        // Coarser levels need whole chunks to step over, other maps are only ever
+        // drawn at full detail
+
+        terrain.m_levels = terrain.m_stride % chunk_size == 0 ? lod_levels : 1;
+
+        auto offset = 0;
+
+        for (auto level = 0; level < terrain.m_levels; level++)
+        {
+            const auto cells = terrain.m_stride >> level;
+
+            terrain.m_level_offsets[level] = offset;
+
+            offset += cells * cells * 2;
+        }
+
+        terrain.m_blocks = (terrain.m_stride + block_size - 1) / block_size;
+
+        terrain.m_block_min_heights.assign(terrain.m_blocks * terrain.m_blocks, std::numeric_limits<float>::max());
+        terrain.m_block_max_heights.assign(terrain.m_blocks * terrain.m_blocks, std::numeric_limits<float>::lowest());
+
+        for (auto z = 0; z <= terrain.m_stride; z++)
+        {
+            for (auto x = 0; x <= terrain.m_stride; x++)
+            {
+                const auto h = height_map[z * stride_plus_one + x];
+
+                // Vertices on a block's far edges are shared with the next block
+
+                for (auto bz = std::max(0, (z - 1) / block_size); bz <= std::min(terrain.m_blocks - 1, z / block_size); bz++)
+                {
+                    for (auto bx = std::max(0, (x - 1) / block_size); bx <= std::min(terrain.m_blocks - 1, x / block_size); bx++)
+                    {
+                        const auto block = bz * terrain.m_blocks + bx;
+
+                        terrain.m_block_min_heights[block] = std::min(terrain.m_block_min_heights[block], h);
+                        terrain.m_block_max_heights[block] = std::max(terrain.m_block_max_heights[block], h);
+                    }
+                }
+            }
+        }
+
+        return terrain;
+    }
+
+    int chunk_count() const { return static_cast<int>(m_chunks.size()); }
+
+    // Number of levels of detail, the height map mesh has to be built with as many
+
+    int levels() const { return m_levels; }
+
+    // Level of detail for a chunk, from the distance to its nearest point. The
+    // nearest points of two neighbouring chunks are never more than a chunk's
+    // diagonal apart and every level covers more than that, so neighbours are at
+    // most one level apart
+
+    int lod_level(
+        int chunk,
+        const Vec4 &camera) const
+    {
+        const auto &node = m_nodes[chunk];
+
+        const auto dx = camera.x() - std::clamp(camera.x(), static_cast<float>(node.x0), static_cast<float>(node.x1));
+        const auto dz = camera.z() - std::clamp(camera.z(), static_cast<float>(node.z0), static_cast<float>(node.z1));
+
+        const auto height = lod_height(camera);
+
+        const auto distance = std::sqrt(dx * dx + dz * dz + height * height);
+
+        auto level = 0;
+
+        while (level + 1 < m_levels && distance >= lod_range(level))
+        {
+            level++;
+        }
+
+        return level;
+    }
+
+    // Heights of the vertices [first, first + count) morphed towards the next
+    // coarser level. A vertex that level drops slides onto the line between its
+    // neighbours either side that it keeps, and is all the way there by the time
+    // its chunk could switch to that level. How far only depends on the vertex's
+    // own distance, so every chunk sharing a vertex agrees on where it is and
+    // neighbouring levels meet without cracks. How far each vertex has gone, from
+    // 0 to 1, is written to `morphs`
+
+    void morph_heights(
+        const Vec4 &camera,
+        const float *ys,
+        int first,
+        int count,
+        float *heights,
+        float *morphs) const
+    {
+        const auto stride_plus_one = m_stride + 1;
+
+        const auto height = lod_height(camera);
+
+        for (auto i = first; i < first + count; i++)
+        {
+            heights[i] = ys[i];
+
+            morphs[i] = 0.0f;
+
+            const auto x = i % stride_plus_one;
+            const auto z = i / stride_plus_one;
+
+            // The finest level that drops this vertex, the coarsest keeps every
+            // vertex it has
+
+            const auto level = std::countr_zero(static_cast<unsigned>(x | z));
+
+            if (level >= m_levels - 1)
+            {
+                continue;
+            }
+
+            const auto dx = camera.x() - static_cast<float>(x);
+            const auto dz = camera.z() - static_cast<float>(z);
+
+            const auto distance = std::sqrt(dx * dx + dz * dz + height * height);
+
+            const auto start = morph_start(level);
+
+            const auto end = lod_range(level);
+
+            const auto morph = std::clamp((distance - start) / (end - start), 0.0f, 1.0f);
+
+            if (morph == 0.0f)
+            {
+                continue;
+            }
+
+            morphs[i] = morph;
+
+            // Neighbours along a row, a column or the cell's diagonal, whichever
+            // the coarser level has an edge along
+
+            const auto step = 1 << level;
+
+            const auto dx_step = (x & step) != 0 ? step : 0;
+            const auto dz_step = (z & step) != 0 ? step * stride_plus_one : 0;
+
+            const auto target = (ys[i - dx_step - dz_step] + ys[i + dx_step + dz_step]) * 0.5f;
+
+            heights[i] = ys[i] + (target - ys[i]) * morph;
+        }
+    }
+
+    // The triangle of the next coarser level that mesh triangle `triangle` lies
+    // inside, or -1 at the coarsest level. Every level splits its cells along the
+    // same diagonal, so the two cells on a coarse cell's diagonal keep their sides
+    // of it and the other two lie wholly on one side
+
+    int parent_triangle(
+        int triangle) const
+    {
+        auto level = m_levels - 1;
+
+        while (level > 0 && triangle < m_level_offsets[level])
+        {
+            level--;
+        }
+
+        if (level + 1 >= m_levels)
+        {
+            return -1;
+        }
+
+        const auto cells = m_stride >> level;
+
+        const auto local = triangle - m_level_offsets[level];
+
+        const auto x = (local / 2) % cells;
+        const auto z = (local / 2) / cells;
+
+        const auto side = (x & 1) == (z & 1) ? local % 2 : x & 1;
+
+        return m_level_offsets[level + 1] + ((z / 2) * (cells / 2) + x / 2) * 2 + side;
+    }
+
+    // Collect the chunks that intersect the frustum and lie within `max_distance`
+    // of `camera` (both in model space), ordered from the back to the front
+
+    void find_visible_chunks(
+        const Frustum &frustum,
+        const Vec4 &camera,
+        float max_distance,
+        std::vector<int> &chunks) const
+    {
+        if (m_root >= 0)
+        {
+            visit(m_root, frustum, camera, max_distance * max_distance, false, chunks);
+        }
+    }
+
+    // A chunk row is contiguous in both the vertex and index buffers of the
+    // height map mesh, so each row at the chunk's level becomes one range of each
+
+    void chunk_ranges(
+        int chunk,
+        int level,
+        std::vector<IndexRange> &vertex_ranges,
+        std::vector<IndexRange> &triangle_ranges) const
+    {
+        const auto &node = m_nodes[chunk];
+
+        const auto stride_plus_one = m_stride + 1;
+
+        const auto step = 1 << level;
+
+        const auto cells = m_stride >> level;
+
+        for (auto z = node.z0; z <= node.z1; z += step)
+        {
+            vertex_ranges.push_back(IndexRange{z * stride_plus_one + node.x0, node.x1 - node.x0 + 1});
+        }
+
+        for (auto z = node.z0 / step; z < node.z1 / step; z++)
+        {
+            triangle_ranges.push_back(IndexRange{m_level_offsets[level] + (z * cells + node.x0 / step) * 2, (node.x1 - node.x0) / step * 2});
+        }
+    }
+
+    // Append the triangles of a chunk at `level` in painter's order for a camera
+    // at `camera`. Rows go from the furthest to the nearest, then columns within
+    // each row, then the two triangles of each cell
+
+    void append_back_to_front(
+        int chunk,
+        int level,
+        const Vec4 &camera,
+        std::vector<int> &triangles) const
+    {
+        const auto &node = m_nodes[chunk];
+
+        const auto step = 1 << level;
+
+        const auto cells = m_stride >> level;
+
+        // Cells of the level's grid are a unit across
+
+        const auto camera_x = camera.x() / static_cast<float>(step);
+        const auto camera_z = camera.z() / static_cast<float>(step);
+
+        int rows[chunk_size];
+
+        int columns[chunk_size];
+
+        far_to_near(node.z0 / step, node.z1 / step, camera_z, rows);
+
+        far_to_near(node.x0 / step, node.x1 / step, camera_x, columns);
+
+        for (auto r = 0; r < (node.z1 - node.z0) / step; r++)
+        {
+            const auto z = rows[r];
+
+            for (auto c = 0; c < (node.x1 - node.x0) / step; c++)
+            {
+                const auto x = columns[c];
+
+                const auto n1 = m_level_offsets[level] + (z * cells + x) * 2;
+
+                const auto n2 = n1 + 1;
+
+                // The cell's diagonal runs from (x, z) to (x + 1, z + 1), n1 lies on
+                // the low x / high z side of it and n2 on the high x / low z side
+
+                if (camera_x - static_cast<float>(x) > camera_z - static_cast<float>(z))
+                {
+                    triangles.push_back(n1);
+                    triangles.push_back(n2);
+                }
+                else
+                {
+                    triangles.push_back(n2);
+                    triangles.push_back(n1);
+                }
+            }
+        }
+    }
+
+    // Model space bounds of a node
+
+    void bounds(
+        int index,
+        Vec4 &min,
+        Vec4 &max) const
+    {
+        const auto &node = m_nodes[index];
+
+        min = Vec4(static_cast<float>(node.x0), node.min_height, static_cast<float>(node.z0));
+        max = Vec4(static_cast<float>(node.x1), node.max_height, static_cast<float>(node.z1));
+    }
+
+    // Boxes under each block of a chunk, from the lowest point of the map to the
+    // lowest point of the block, as min and max corner pairs. The surface never
+    // dips into them, so a line of sight from above that reaches one has gone
+    // through the surface. Blocks only hold while a chunk is drawn at full detail
+    // with none of it morphing, otherwise the chunk only has the box under its own
+    // lowest point
+
+    void append_occluders(
+        int chunk,
+        const Vec4 &camera,
+        std::vector<Vec4> &boxes) const
+    {
+        const auto &node = m_nodes[chunk];
+
+        const auto floor = m_nodes[m_root].min_height;
+
+        const auto dx = std::max(std::abs(camera.x() - static_cast<float>(node.x0)), std::abs(camera.x() - static_cast<float>(node.x1)));
+        const auto dz = std::max(std::abs(camera.z() - static_cast<float>(node.z0)), std::abs(camera.z() - static_cast<float>(node.z1)));
+
+        const auto height = lod_height(camera);
+
+        if (m_levels > 1 && dx * dx + dz * dz + height * height > morph_start(0) * morph_start(0))
+        {
+            boxes.push_back(Vec4(static_cast<float>(node.x0), floor, static_cast<float>(node.z0)));
+            boxes.push_back(Vec4(static_cast<float>(node.x1), node.min_height, static_cast<float>(node.z1)));
+
+            return;
+        }
+
+        for (auto z = node.z0; z < node.z1; z += block_size)
+        {
+            for (auto x = node.x0; x < node.x1; x += block_size)
+            {
+                const auto height = m_block_min_heights[(z / block_size) * m_blocks + x / block_size];
+
+                const auto x0 = static_cast<float>(x);
+                const auto z0 = static_cast<float>(z);
+                const auto x1 = static_cast<float>(std::min(x + block_size, node.x1));
+                const auto z1 = static_cast<float>(std::min(z + block_size, node.z1));
+
+                boxes.push_back(Vec4(x0, floor, z0));
+                boxes.push_back(Vec4(x1, height, z1));
+            }
+        }
+    }
+
+    // True if every point of a node is within `max_distance` of `camera`, so none
+    // of its triangles are dropped for being too far away
+
+    bool is_within(
+        int index,
+        const Vec4 &camera,
+        float max_distance) const
+    {
+        const auto &node = m_nodes[index];
+
+        const auto dx = std::max(std::abs(camera.x() - static_cast<float>(node.x0)), std::abs(camera.x() - static_cast<float>(node.x1)));
+        const auto dy = std::max(std::abs(camera.y() - node.min_height), std::abs(camera.y() - node.max_height));
+        const auto dz = std::max(std::abs(camera.z() - static_cast<float>(node.z0)), std::abs(camera.z() - static_cast<float>(node.z1)));
+
+        return dx * dx + dy * dy + dz * dz <= max_distance * max_distance;
+    }
+
+    // Terrain can only hide terrain from a camera over the map and more than
+    // `clearance` above the surface around it. Otherwise a line of sight could
+    // pass under the surface at the map's edge, or cross it in front of the near
+    // plane where nothing is drawn
+
+    bool is_above_surface(
+        const Vec4 &camera,
+        float clearance) const
+    {
+        const auto stride = static_cast<float>(m_stride);
+
+        if (camera.x() < 0.0f || camera.z() < 0.0f || camera.x() > stride || camera.z() > stride)
+        {
+            return false;
+        }
+
+        // High enough for the ground below to be morphing or drawn coarser, the
+        // blocks then say nothing about it. None of the blocks checked below are
+        // further across than `reach`
+
+        const auto reach = 1.415f * 2.0f * (clearance + block_size);
+
+        if (m_levels > 1 && lod_height(camera) + reach >= morph_start(0))
+        {
+            return camera.y() - clearance > m_nodes[m_root].max_height;
+        }
+
+        const auto to_block = [this](float v)
+        {
+            return std::clamp(static_cast<int>(std::floor(v / block_size)), 0, m_blocks - 1);
+        };
+
+        for (auto bz = to_block(camera.z() - clearance); bz <= to_block(camera.z() + clearance); bz++)
+        {
+            for (auto bx = to_block(camera.x() - clearance); bx <= to_block(camera.x() + clearance); bx++)
+            {
+                if (m_block_max_heights[bz * m_blocks + bx] >= camera.y() - clearance)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+private:
+    // Longest distance across a chunk, rounded up
+
+    static constexpr float chunk_diagonal = 1.415f * chunk_size;
+
+    // Distance out to which `level` is used
+
+    static float lod_range(
+        int level)
+    {
+        return lod_distance * static_cast<float>(1 << level);
+    }
+
+    // Distance from which the vertices `level` drops start to morph. A chunk only
+    // uses `level` from half of its range, and none of its vertices are more than
+    // a chunk's diagonal further away than that
+
+    static float morph_start(
+        int level)
+    {
+        return lod_range(level) * 0.5f + chunk_diagonal;
+    }
+
+    // Level of detail distances take in the camera's height over the lowest point
+    // of the map, so flying higher makes all of the terrain coarser
+
+    float lod_height(
+        const Vec4 &camera) const
+    {
+        return std::max(0.0f, camera.y() - m_nodes[m_root].min_height);
+    }
+
+    // Visit the cells of [first, last) from the furthest from `camera` to the nearest,
+    // the furthest remaining cell is always at one end or the other
+
+    static void far_to_near(
+        int first,
+        int last,
+        float camera,
+        int *cells)
+    {
+        auto low = first;
+
+        auto high = last - 1;
+
+        auto n = 0;
+
+        while (low <= high)
+        {
+            if (std::abs(static_cast<float>(low) + 0.5f - camera) >= std::abs(static_cast<float>(high) + 0.5f - camera))
+            {
+                cells[n++] = low++;
+            }
+            else
+            {
+                cells[n++] = high--;
+            }
+        }
+    }
+
+    int build(
+        const std::vector<float> &height_map,
+        int x0,
+        int z0,
+        int size)
+    {
+        if (x0 >= m_stride || z0 >= m_stride)
+        {
+            return -1;
+        }
+
+        auto node = TerrainNode{
+            x0,
+            z0,
+            std::min(x0 + size, m_stride),
+            std::min(z0 + size, m_stride),
+            size,
+            std::numeric_limits<float>::max(),
+            std::numeric_limits<float>::lowest(),
+            {-1, -1, -1, -1}};
+
+        if (size <= chunk_size)
+        {
+            for (auto z = node.z0; z <= node.z1; z++)
+            {
+                for (auto x = node.x0; x <= node.x1; x++)
+                {
+                    const auto h = height_map[z * (m_stride + 1) + x];
+
+                    node.min_height = std::min(node.min_height, h);
+                    node.max_height = std::max(node.max_height, h);
+                }
+            }
+
+            m_nodes.push_back(node);
+
+            m_chunks.push_back(static_cast<int>(m_nodes.size()) - 1);
+
+            return static_cast<int>(m_nodes.size()) - 1;
+        }
+
+        const auto half = size / 2;
+
+        node.children[0] = build(height_map, x0, z0, half);
+        node.children[1] = build(height_map, x0 + half, z0, half);
+        node.children[2] = build(height_map, x0, z0 + half, half);
+        node.children[3] = build(height_map, x0 + half, z0 + half, half);
+
+        for (const auto child : node.children)
+        {
+            if (child >= 0)
+            {
+                node.min_height = std::min(node.min_height, m_nodes[child].min_height);
+                node.max_height = std::max(node.max_height, m_nodes[child].max_height);
+            }
+        }
+
+        m_nodes.push_back(node);
+
+        return static_cast<int>(m_nodes.size()) - 1;
+    }
+
+    void visit(
+        int index,
+        const Frustum &frustum,
+        const Vec4 &camera,
+        float max_distance_squared,
+        bool inside,
+        std::vector<int> &chunks) const
+    {
+        const auto &node = m_nodes[index];
+
+        const auto min = Vec4(static_cast<float>(node.x0), node.min_height, static_cast<float>(node.z0));
+        const auto max = Vec4(static_cast<float>(node.x1), node.max_height, static_cast<float>(node.z1));
+
+        // Nearest point of the box to the camera, if that is out of range so is every triangle
+
+        const auto dx = camera.x() - std::clamp(camera.x(), min.x(), max.x());
+        const auto dy = camera.y() - std::clamp(camera.y(), min.y(), max.y());
+        const auto dz = camera.z() - std::clamp(camera.z(), min.z(), max.z());
+
+        if (dx * dx + dy * dy + dz * dz > max_distance_squared)
+        {
+            return;
+        }
+
+        // Once a node is entirely inside the frustum, so are all of its children
+
+        if (!inside)
+        {
+            const auto containment = frustum.test_box(min, max);
+
+            if (containment == Frustum::Containment::outside)
+            {
+                return;
+            }
+
+            inside = containment == Frustum::Containment::inside;
+        }
+
+        if (node.children[0] < 0 && node.children[1] < 0 && node.children[2] < 0 && node.children[3] < 0)
+        {
+            chunks.push_back(index);
+
+            return;
+        }
+
+        // The child diagonally opposite the camera's quadrant goes first and the
+        // child on the camera's side goes last. A tile can only be hidden by tiles
+        // between it and the camera, which this order always draws later
+
+        const auto half = node.size / 2;
+
+        const auto near_x = camera.x() >= static_cast<float>(node.x0 + half) ? 1 : 0;
+        const auto near_z = camera.z() >= static_cast<float>(node.z0 + half) ? 2 : 0;
+
+        const auto near = near_x | near_z;
+
+        for (const auto child : {near ^ 3, near ^ 1, near ^ 2, near})
+        {
+            if (node.children[child] >= 0)
+            {
+                visit(node.children[child], frustum, camera, max_distance_squared, inside, chunks);
+            }
+        }
+    }
+
+    int m_stride = 0;
+    int m_root = -1;
+    int m_blocks = 0;
+    int m_levels = 1;
+    int m_level_offsets[lod_levels] = {};
+    std::vector<TerrainNode> m_nodes;
+    std::vector<int> m_chunks;
+    std::vector<float> m_block_min_heights;
+    std::vector<float> m_block_max_heights;
+};
+
+// Coarse screen space depth buffer of surfaces known to be solid, for rejecting
+// terrain chunks hidden behind nearer hills before any of their vertices are
+// transformed. A cell only takes an occluder that covers all of it, and keeps the
+// occluder's furthest depth, so a box deeper than that in every cell it touches
+// is certain to be hidden
+
+class OcclusionBuffer
+{
+public:
+    static constexpr int cell_size = 8;
+
+    void clear(
+        float width,
+        float height)
+    {
+        m_width = width;
+        m_height = height;
+
+        m_columns = std::max(1, static_cast<int>(std::ceil(width / cell_size)));
+        m_rows = std::max(1, static_cast<int>(std::ceil(height / cell_size)));
+
+        m_depth.assign(m_columns * m_rows, std::numeric_limits<float>::max());
+    }
+
+    // A box that crosses the near plane is never hidden
+
+    bool is_occluded(
+        const Matrix4x4 &world_view_projection,
+        const Vec4 &min,
+        const Vec4 &max) const
+    {
+        auto min_x = std::numeric_limits<float>::max();
+        auto min_y = std::numeric_limits<float>::max();
+        auto max_x = std::numeric_limits<float>::lowest();
+        auto max_y = std::numeric_limits<float>::lowest();
+
+        auto min_z = std::numeric_limits<float>::max();
+
+        for (auto corner = 0; corner < 8; corner++)
+        {
+            const auto point = Vec4(
+                (corner & 1) ? max.x() : min.x(),
+                (corner & 2) ? max.y() : min.y(),
+                (corner & 4) ? max.z() : min.z());
+
+            float x, y, z;
+
+            if (!project(world_view_projection, point, x, y, z))
+            {
+                return false;
+            }
+
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+
+            min_z = std::min(min_z, z);
+        }
+
+        const auto c0 = std::max(0, static_cast<int>(std::floor(min_x / cell_size)));
+        const auto r0 = std::max(0, static_cast<int>(std::floor(min_y / cell_size)));
+        const auto c1 = std::min(m_columns - 1, static_cast<int>(std::floor(max_x / cell_size)));
+        const auto r1 = std::min(m_rows - 1, static_cast<int>(std::floor(max_y / cell_size)));
+
+        if (c0 > c1 || r0 > r1)
+        {
+            return false;
+        }
+
+        for (auto r = r0; r <= r1; r++)
+        {
+            for (auto c = c0; c <= c1; c++)
+            {
+                if (m_depth[r * m_columns + c] >= min_z)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // Add a solid box, nothing behind it can be seen through it
+
+    void add_occluder(
+        const Matrix4x4 &world_view_projection,
+        const Vec4 &min,
+        const Vec4 &max)
+    {
+        // The box covers the convex hull of its projected corners, as long as none
+        // of them are in front of the near plane
+
+        Vec4 points[8];
+
+        auto max_z = std::numeric_limits<float>::lowest();
+
+        for (auto corner = 0; corner < 8; corner++)
+        {
+            const auto point = Vec4(
+                (corner & 1) ? max.x() : min.x(),
+                (corner & 2) ? max.y() : min.y(),
+                (corner & 4) ? max.z() : min.z());
+
+            float x, y, z;
+
+            if (!project(world_view_projection, point, x, y, z))
+            {
+                return;
+            }
+
+            points[corner] = Vec4(x, y, z);
+
+            max_z = std::max(max_z, z);
+        }
+
+        Vec4 hull[8];
+
+        const auto n_hull = convex_hull(points, hull);
+
+        if (n_hull < 3)
+        {
+            return;
+        }
+
+        // Cells entirely within the hull's bounds, then entirely within the hull
+
+        auto min_x = std::numeric_limits<float>::max();
+        auto min_y = std::numeric_limits<float>::max();
+        auto max_x = std::numeric_limits<float>::lowest();
+        auto max_y = std::numeric_limits<float>::lowest();
+
+        for (auto i = 0; i < n_hull; i++)
+        {
+            min_x = std::min(min_x, hull[i].x());
+            min_y = std::min(min_y, hull[i].y());
+            max_x = std::max(max_x, hull[i].x());
+            max_y = std::max(max_y, hull[i].y());
+        }
+
+        const auto c0 = std::max(0, static_cast<int>(std::ceil(min_x / cell_size)));
+        const auto r0 = std::max(0, static_cast<int>(std::ceil(min_y / cell_size)));
+        const auto c1 = std::min(m_columns, static_cast<int>(std::floor(max_x / cell_size))) - 1;
+        const auto r1 = std::min(m_rows, static_cast<int>(std::floor(max_y / cell_size))) - 1;
+
+        const auto is_inside = [&hull, n_hull](float px, float py)
+        {
+            for (auto i = 0; i < n_hull; i++)
+            {
+                const auto &a = hull[i];
+                const auto &b = hull[(i + 1) % n_hull];
+
+                if ((b.x() - a.x()) * (py - a.y()) - (b.y() - a.y()) * (px - a.x()) < 0.0f)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        };
+
+        for (auto r = r0; r <= r1; r++)
+        {
+            for (auto c = c0; c <= c1; c++)
+            {
+                const auto left = static_cast<float>(c * cell_size);
+                const auto top = static_cast<float>(r * cell_size);
+                const auto right = left + cell_size;
+                const auto bottom = top + cell_size;
+
+                if (is_inside(left, top) && is_inside(right, top) && is_inside(left, bottom) && is_inside(right, bottom))
+                {
+                    auto &depth = m_depth[r * m_columns + c];
+
+                    depth = std::min(depth, max_z);
+                }
+            }
+        }
+    }
+
+private:
+    // Monotone chain over the x and y of 8 points, the hull comes back wound so
+    // that the inside is on the left of every edge
+
+    static int convex_hull(
+        const Vec4 (&points)[8],
+        Vec4 (&hull)[8])
+    {
+        Vec4 sorted[8];
+
+        std::copy(std::begin(points), std::end(points), sorted);
+
+        std::sort(std::begin(sorted), std::end(sorted), [](const Vec4 &a, const Vec4 &b)
+                  { return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y()); });
+
+        const auto cross = [](const Vec4 &o, const Vec4 &a, const Vec4 &b)
+        {
+            return (a.x() - o.x()) * (b.y() - o.y()) - (a.y() - o.y()) * (b.x() - o.x());
+        };
+
+        Vec4 chain[16];
+
+        auto n = 0;
+
+        for (auto i = 0; i < 8; i++)
+        {
+            while (n >= 2 && cross(chain[n - 2], chain[n - 1], sorted[i]) <= 0.0f)
+            {
+                n--;
+            }
+
+            chain[n++] = sorted[i];
+        }
+
+        for (auto i = 6, lower = n + 1; i >= 0; i--)
+        {
+            while (n >= lower && cross(chain[n - 2], chain[n - 1], sorted[i]) <= 0.0f)
+            {
+                n--;
+            }
+
+            chain[n++] = sorted[i];
+        }
+
+        // The last point repeats the first
+
+        n = std::max(0, n - 1);
+
+        std::copy(chain, chain + n, hull);
+
+        return n;
+    }
+
+    // Model Space --> Screen Space the same way VertexBatch does it, false for
+    // points in front of the near plane
+
+    bool project(
+        const Matrix4x4 &world_view_projection,
+        const Vec4 &point,
+        float &x,
+        float &y,
+        float &z) const
+    {
+        const auto clip = Matrix4x4::multiply_vector(world_view_projection, point);
+
+        if (clip.z() <= 0.0f || clip.w() <= 0.0f)
+        {
+            return false;
+        }
+
+        const auto inv_w = 1.0f / clip.w();
+
+        x = (1.0f - clip.x() * inv_w) * 0.5f * m_width;
+        y = (1.0f - clip.y() * inv_w) * 0.5f * m_height;
+        z = clip.z() * inv_w;
+
+        return true;
+    }
+
+    float m_width = 0.0f;
+    float m_height = 0.0f;
+    int m_columns = 0;
+    int m_rows = 0;
+    std::vector<float> m_depth;
+};
+
+// Orders triangles from back to front by radix sorting 32 bit depth keys, seeded
+// with the previous frame's order since the view rarely changes much between frames
+
+class DepthSorter
+{
+public:
+    // Returns positions into `triangles`, furthest first
+
+    const std::vector<int> &sort(
+        const std::vector<IndexedTriangle> &triangles,
+        int n_sources)
+    {
+        const auto n = static_cast<int>(triangles.size());
+
+        m_order.resize(n);
+
+        m_keys.resize(n);
+
+        for (auto i = 0; i < n; i++)
+        {
+            m_keys[i] = key_given_depth(triangles[i].depth);
+        }
+
+        seed(triangles, n_sources);
+
+        // Most frames only a few neighbours swap, fix those in place and only fall
+        // back to the full sort once that stops being cheap
+
+        if (!insertion_sort(n))
+        {
+            radix_sort(n);
+        }
+
+        // Remember each source triangle's position for the next frame
+
+        m_rank.assign(n_sources, -1);
+
+        for (auto i = 0; i < n; i++)
+        {
+            const auto source = triangles[m_order[i]].source;
+
+            if (m_rank[source] < 0)
+            {
+                m_rank[source] = i;
+            }
+        }
+
+        return m_order;
+    }
+
+private:
+    // Larger depths map to smaller keys, so ascending keys draw far to near
+
+    static uint32_t key_given_depth(
+        float depth)
+    {
+        uint32_t bits;
+
+        std::memcpy(&bits, &depth, sizeof(bits));
+
+        bits ^= (bits & 0x80000000u) ? 0xffffffffu : 0x80000000u;
+
+        return ~bits;
+    }
+
+    // Start from last frame's order, triangles that were not drawn then go last
+
+    void seed(
+        const std::vector<IndexedTriangle> &triangles,
+        int n_sources)
+    {
+        const auto n = static_cast<int>(triangles.size());
+
+        if (static_cast<int>(m_rank.size()) != n_sources)
+        {
+            m_rank.assign(n_sources, -1);
+        }
+
+        // Counting sort on previous rank, the extra bucket at the end is for new triangles
+
+        const auto n_buckets = n_sources + 1;
+
+        m_counts.assign(n_buckets + 1, 0);
+
+        for (const auto &t : triangles)
+        {
+            const auto rank = m_rank[t.source];
+
+            m_counts[(rank < 0 ? n_sources : rank) + 1]++;
+        }
+
+        for (auto i = 1; i <= n_buckets; i++)
+        {
+            m_counts[i] += m_counts[i - 1];
+        }
+
+        for (auto i = 0; i < n; i++)
+        {
+            const auto rank = m_rank[triangles[i].source];
+
+            m_order[m_counts[rank < 0 ? n_sources : rank]++] = i;
+        }
+    }
+
+    // Give up once the shifts exceed a small multiple of `n`, the order is then too
+    // far from sorted for this to beat the radix sort
+
+    bool insertion_sort(
+        int n)
+    {
+        auto budget = static_cast<int64_t>(n) * 4;
+
+        for (auto i = 1; i < n; i++)
+        {
+            const auto index = m_order[i];
+
+            const auto key = m_keys[index];
+
+            auto j = i;
+
+            while (j > 0 && m_keys[m_order[j - 1]] > key)
+            {
+                m_order[j] = m_order[j - 1];
+
+                j--;
+
+                if (--budget < 0)
+                {
+                    m_order[j] = index;
+
+                    return false;
+                }
+            }
+
+            m_order[j] = index;
+        }
+
+        return true;
+    }
+
+    // Least significant byte first, stable, skipping any byte all keys share
+
+    void radix_sort(
+        int n)
+    {
+        m_pairs.resize(n);
+
+        m_scratch.resize(n);
+
+        for (auto i = 0; i < n; i++)
+        {
+            m_pairs[i] = {m_keys[m_order[i]], m_order[i]};
+        }
+
+        uint32_t counts[4][256] = {};
+
+        for (const auto &pair : m_pairs)
+        {
+            for (auto pass = 0; pass < 4; pass++)
+            {
+                counts[pass][(pair.first >> (pass * 8)) & 0xff]++;
+            }
+        }
+
+        for (auto pass = 0; pass < 4; pass++)
+        {
+            auto &count = counts[pass];
+
+            if (count[(m_pairs[0].first >> (pass * 8)) & 0xff] == static_cast<uint32_t>(n))
+            {
+                continue;
+            }
+
+            uint32_t offset = 0;
+
+            for (auto &it : count)
+            {
+                const auto c = it;
+
+                it = offset;
+
+                offset += c;
+            }
+
+            for (const auto &pair : m_pairs)
+            {
+                m_scratch[count[(pair.first >> (pass * 8)) & 0xff]++] = pair;
+            }
+
+            std::swap(m_pairs, m_scratch);
+        }
+
+        for (auto i = 0; i < n; i++)
+        {
+            m_order[i] = m_pairs[i].second;
+        }
+    }
+
+    std::vector<int> m_order;
+    std::vector<uint32_t> m_keys;
+    std::vector<int> m_rank;
+    std::vector<int> m_counts;
+    std::vector<std::pair<uint32_t, int>> m_pairs;
+    std::vector<std::pair<uint32_t, int>> m_scratch;
+};
+
+// One worker's share of the triangle stage. Vertices created by clipping go into
+// the slice's own batch and are renumbered when the slices are merged
+
+struct TriangleSlice
+{
+    VertexBatch vertices;
+    std::vector<IndexedTriangle> triangles;
+    ClipSpaceClipper clipper;
+    int culled = 0;
+
+    void clear()
+    {
+        vertices.clear();
+        triangles.clear();
+        clipper = ClipSpaceClipper();
+        culled = 0;
+    }
+};
+
+// Open addressing set of edges, each keyed by its two vertex indices packed into
+// 64 bits. Clearing keeps the slots, so steady state frames don't allocate
+
+class EdgeSet
+{
+public:
+    static uint64_t key(
+        int a,
+        int b)
+    {
+        const auto low = static_cast<uint32_t>(std::min(a, b));
+        const auto high = static_cast<uint32_t>(std::max(a, b));
+
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
+    // Make room for `count` edges at no more than half load
+
+    void clear(
+        int count)
+    {
+        auto size = 16;
+
+        while (size < count * 2)
+        {
+            size *= 2;
+        }
+
+        m_slots.assign(size, empty);
+
+        m_mask = static_cast<uint64_t>(size - 1);
+    }
+
+    // True if the edge was not already in the set
+
+    bool insert(
+        uint64_t edge)
+    {
+        auto slot = (edge * 0x9e3779b97f4a7c15ull >> 32) & m_mask;
+
+        while (m_slots[slot] != empty)
+        {
+            if (m_slots[slot] == edge)
+            {
+                return false;
+            }
+
+            slot = (slot + 1) & m_mask;
+        }
+
+        m_slots[slot] = edge;
+
+        return true;
+    }
+
+private:
+    static constexpr uint64_t empty = ~0ull;
+
+    std::vector<uint64_t> m_slots;
+    uint64_t m_mask = 0;
+};
+
+// Rolling per stage timings of the last `history` frames drawn, for percentiles
+// and a CSV dump. Each frame's build stages travel with it from the update thread,
+// so only the main thread ever touches the profiler
+
+class Profiler
+{
+public:
+    // The first six stages run on the update thread while a frame is built, the
+    // rest on the main thread while it is drawn
+
+    enum class Stage
+    {
+        visibility,     // chunk, meshlet and occlusion culling
+        transform,      // morphing and projecting vertices
+        clip,           // per triangle culling, lighting and clipping
+        sort,           // depth sorting for the renderer
+        vertices,       // building the renderer's vertices
+        wireframe,      // building the edge quads
+        draw,           // RenderGeometry, or rasterizing and uploading the texture
+        draw_wireframe, // the wireframe's RenderGeometry
+        present,
+        count
+    };
+
+    static constexpr int stage_count = static_cast<int>(Stage::count);
+
+    static constexpr const char *stage_names[stage_count] = {
+        "visibility",
+        "transform",
+        "clip",
+        "sort",
+        "vertices",
+        "wireframe",
+        "draw",
+        "draw_wireframe",
+        "present"};
+
+    static constexpr int history = 1024;
+
+    struct Frame
+    {
+        std::array<int64_t, stage_count> nanoseconds = {};
+
+        // Triangles going into per triangle culling, dropped by it, and handed
+        // to the renderer after clipping
+
+        int triangles_in = 0;
+        int triangles_culled = 0;
+        int triangles_emitted = 0;
+
+        // False for a frame drawn again without being rebuilt, whose build stage
+        // timings were already counted the first time it was drawn
+
+        bool is_rebuilt = false;
+    };
+
+    // Times a stage from construction until the next stage starts or the timer
+    // is stopped or destroyed, adding to whatever the stage already has
+
+    class Timer
+    {
+    public:
+        Timer(
+            Frame &frame,
+            Stage stage)
+            : m_frame(frame), m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+
+        Timer(const Timer &) = delete;
+
+        Timer &operator=(const Timer &) = delete;
+
+        ~Timer()
+        {
+            stop();
+        }
+
+        void next(
+            Stage stage)
+        {
+            stop();
+
+            m_stage = stage;
+
+            m_start = std::chrono::steady_clock::now();
+
+            m_is_running = true;
+        }
+
+        void stop()
+        {
+            if (!m_is_running)
+            {
+                return;
+            }
+
+            const auto time = std::chrono::steady_clock::now() - m_start;
+
+            m_frame.nanoseconds[static_cast<int>(m_stage)] += std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+
+            m_is_running = false;
+        }
+
+    private:
+        Frame &m_frame;
+        Stage m_stage;
+        std::chrono::steady_clock::time_point m_start;
+        bool m_is_running = true;
+    };
+
+    void add(
+        const Frame &frame)
+    {
+        m_frames[m_next % history] = frame;
+
+        m_next++;
+    }
+
+    // The `percent`th percentile of a stage over the frames held, build stages
+    // only counting frames that were rebuilt
+
+    int64_t percentile(
+        Stage stage,
+        int percent) const
+    {
+        const auto is_build_stage = stage < Stage::draw;
+
+        auto &values = m_values;
+
+        values.clear();
+
+        for (auto i = 0; i < std::min<int64_t>(m_next, history); i++)
+        {
+            if (!is_build_stage || m_frames[i].is_rebuilt)
+            {
+                values.push_back(m_frames[i].nanoseconds[static_cast<int>(stage)]);
+            }
+        }
+
+        if (values.empty())
+        {
+            return 0;
+        }
+
+        const auto n = std::min(values.size() - 1, values.size() * percent / 100);
+
+        std::nth_element(values.begin(), values.begin() + n, values.end());
+
+        return values[n];
+    }
+
+    // The most recently added frame
+
+    const Frame &last() const
+    {
+        return m_frames[(m_next + history - 1) % history];
+    }
+
+    // One row per frame held, oldest first
+
+    std::optional<Error> write_csv(
+        const std::string &filename) const
+    {
+        std::ofstream file(filename);
+
+        if (!file.is_open())
+        {
+            return Error("profile", "Could not open file");
+        }
+
+        file << "frame,rebuilt";
+
+        for (const auto name : stage_names)
+        {
+            file << "," << name << "_ns";
+        }
+
+        file << ",triangles_in,triangles_culled,triangles_emitted\n";
+
+        for (auto f = std::max<int64_t>(0, m_next - history); f < m_next; f++)
+        {
+            const auto &frame = m_frames[f % history];
+
+            file << f << "," << (frame.is_rebuilt ? 1 : 0);
+
+            for (const auto time : frame.nanoseconds)
+            {
+                file << "," << time;
+            }
+
+            file << "," << frame.triangles_in << "," << frame.triangles_culled << "," << frame.triangles_emitted << "\n";
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    std::array<Frame, history> m_frames = {};
+    int64_t m_next = 0;
+    mutable std::vector<int64_t> m_values;
+};
+
+// Scratch buffers for building a frame. Everything is cleared rather than freed
+// between frames, so once capacity has grown to fit the view a rebuild makes no
+// heap allocations
+
+struct FrameArena
+{
+    VertexBatch projected_vertices;
+    std::vector<IndexedTriangle> triangles;
+    std::vector<IndexedTriangle> batched_triangles;
+    std::vector<IndexRange> vertex_ranges;
+    std::vector<IndexRange> triangle_ranges;
+    std::vector<int> visible_chunks;
+    std::vector<int> triangle_order;
+    std::vector<int> shared_vertices;
+    std::vector<float> heights;
+    std::vector<float> morphs;
+    std::vector<IndexRange> pieces;
+    std::vector<int> piece_bounds;
+    std::vector<TriangleSlice> slices;
+    EdgeSet edges;
+    OcclusionBuffer occlusion;
+    std::vector<Vec4> occluder_boxes;
+
+    void clear()
+    {
+        projected_vertices.clear();
+        triangles.clear();
+        batched_triangles.clear();
+        vertex_ranges.clear();
+        triangle_ranges.clear();
+        pieces.clear();
+        piece_bounds.clear();
+        visible_chunks.clear();
+        triangle_order.clear();
+        shared_vertices.clear();
+    }
+};
+
+// Geometry handed to the renderer, a finished frame is never written again
+// until the renderer has moved on from it
+
+struct FrameBuffers
+{
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+    std::vector<SDL_Vertex> wireframe_vertices;
+    std::vector<int> wireframe_indices;
+    std::vector<float> depths;
+    int width = 0;
+    int height = 0;
+    ClipSpaceClipper::Stats clip_stats;
+    int visible_chunks = 0;
+    int occluded_chunks = 0;
+    int visible_meshlets = 0;
+    int culled_meshlets = 0;
+    Profiler::Frame profile;
+};
+
+// Single producer, single consumer hand off of the latest value. The producer
+// writes the back slot and swaps it with the middle one, the consumer swaps its
+// front slot with the middle one only when something new was published, so
+// neither side ever waits on the other or sees a half written value
+
+template <typename T>
+class TripleBuffer
+{
+public:
+    T &back()
+    {
+        return m_slots[m_back];
+    }
+
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | fresh, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // True if a newer value replaced the front one
+
+    bool acquire()
+    {
+        if ((m_middle.load(std::memory_order_relaxed) & fresh) == 0)
+        {
+            return false;
+        }
+
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & index_mask;
+
+        return true;
+    }
+
+    const T &front() const
+    {
+        return m_slots[m_front];
+    }
+
+private:
+    static constexpr int index_mask = 3;
+    static constexpr int fresh = 4;
+
+    T m_slots[3];
+    int m_back = 0;
+    std::atomic<int> m_middle = 1;
+    int m_front = 2;
+};
+
+// What the update thread needs from the main thread's event loop. Held keys are
+// a copy of the keyboard state, wheel steps and resets are counted until taken
+
+struct InputState
+{
+    std::array<Uint8, SDL_NUM_SCANCODES> keys = {};
+    int wheel_steps = 0;
+    bool reset_camera = false;
+    int pixel_width = 0;
+    int pixel_height = 0;
+};
+
+// Where the camera was for one update and how long that update was. Recorded
+// paths replay pose by pose, so a benchmark sees the same views every run
+
+struct CameraPose
+{
+    Vec4 camera = Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    float yaw = 0.0f;
+    float pitch = 0.0f;
+    float roll = 0.0f;
+    float elapsed = 0.0f;
+
+    static CameraPose interpolate(
+        const CameraPose &a,
+        const CameraPose &b,
+        float t)
+    {
+        const auto lerp = [t](float x, float y)
+        {
+            return x + (y - x) * t;
+        };
+
+        return CameraPose{
+            Vec4(lerp(a.camera.x(), b.camera.x()), lerp(a.camera.y(), b.camera.y()), lerp(a.camera.z(), b.camera.z()), 1.0f),
+            lerp(a.yaw, b.yaw),
+            lerp(a.pitch, b.pitch),
+            lerp(a.roll, b.roll),
+            b.elapsed};
+    }
+};
+
+// A text file with one pose per line, "x y z yaw pitch roll elapsed", written
+// with shortest round trip floats so a replay lands exactly where the recording
+// did. Lines starting with '#' are comments
+
+class CameraPath
+{
+public:
+    void add(
+        const CameraPose &pose)
+    {
+        m_poses.push_back(pose);
+    }
+
+    const std::vector<CameraPose> &poses() const { return m_poses; }
+
+    static std::variant<CameraPath, Error> load_from_file(
+        const std::string &filename)
+    {
+        std::ifstream file(filename);
+
+        if (!file.is_open())
+        {
+            return Error("path", "Could not open file");
+        }
+
+        CameraPath path;
+
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+
+            std::istringstream iss(line);
+
+            float x, y, z;
+
+            CameraPose pose;
+
+            if (!(iss >> x >> y >> z >> pose.yaw >> pose.pitch >> pose.roll >> pose.elapsed))
+            {
+                return Error("path", "Malformed pose: " + line);
+            }
+
+            pose.camera = Vec4(x, y, z, 1.0f);
+
+            path.add(pose);
+        }
+
+        if (path.m_poses.empty())
+        {
+            return Error("path", "No poses");
+        }
+
+        return path;
+    }
+
+    std::optional<Error> write_to_file(
+        const std::string &filename) const
+    {
+        std::ofstream file(filename);
+
+        if (!file.is_open())
+        {
+            return Error("path", "Could not open file");
+        }
+
+        file << "# x y z yaw pitch roll elapsed\n";
+
+        for (const auto &pose : m_poses)
+        {
+            file << std::format("{} {} {} {} {} {} {}\n", pose.camera.x(), pose.camera.y(), pose.camera.z(), pose.yaw, pose.pitch, pose.roll, pose.elapsed);
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    std::vector<CameraPose> m_poses;
+};
+
+// CPU rasterizer for frames built by the Game. Triangles are binned into screen
+// tiles, then each tile is cleared and filled on its own worker against a depth
+// buffer, so the draw order doesn't matter. The wireframe goes over the top
+// without depth testing. Like the SDL renderer with its default blend mode,
+// colours are written as they are and their alpha is ignored
+
+class SoftwareRasterizer
+{
+public:
+    static constexpr int tile_size = 64;
+
+    SoftwareRasterizer()
+        : m_workers(WorkProcessor::default_thread_count())
+    {
+    }
+
+    void resize(
+        int width,
+        int height)
+    {
+        if (width == m_width && height == m_height)
+        {
+            return;
+        }
+
+        m_width = width;
+        m_height = height;
+
+        m_tiles_x = (m_width + tile_size - 1) / tile_size;
+        m_tiles_y = (m_height + tile_size - 1) / tile_size;
+
+        m_color.assign(static_cast<size_t>(m_width) * m_height, 0);
+        m_depth.assign(static_cast<size_t>(m_width) * m_height, 0.0f);
+
+        m_bins.resize(m_tiles_x * m_tiles_y);
+    }
+
+    int width() const { return m_width; }
+
+    int height() const { return m_height; }
+
+    // RGBA bytes, one row after another
+
+    const uint32_t *pixels() const { return m_color.data(); }
+
+    void draw(
+        const FrameBuffers &frame,
+        Color clear_color,
+        bool render_wireframes)
+    {
+        resize(frame.width, frame.height);
+
+        m_clear_color = pack(clear_color.r, clear_color.g, clear_color.b, clear_color.a);
+
+        m_triangles.clear();
+
+        for (auto &bin : m_bins)
+        {
+            bin.clear();
+        }
+
+        setup(frame.vertices, frame.depths.data(), frame.indices);
+
+        m_n_surface_triangles = static_cast<int>(m_triangles.size());
+
+        if (render_wireframes)
+        {
+            setup(frame.wireframe_vertices, nullptr, frame.wireframe_indices);
+        }
+
+        // Bins keep the submission order, surfaces first and then the wireframe
+
+        for (auto t = 0; t < static_cast<int>(m_triangles.size()); t++)
+        {
+            const auto &triangle = m_triangles[t];
+
+            for (auto ty = triangle.min_y / tile_size; ty <= triangle.max_y / tile_size; ty++)
+            {
+                for (auto tx = triangle.min_x / tile_size; tx <= triangle.max_x / tile_size; tx++)
+                {
+                    m_bins[ty * m_tiles_x + tx].push_back(t);
+                }
+            }
+        }
+
+        ///
+
+        const auto n_tiles = m_tiles_x * m_tiles_y;
+
+        if (m_workers.thread_count() <= 1)
+        {
+            for (auto tile = 0; tile < n_tiles; tile++)
+            {
+                draw_tile(tile);
+            }
+
+            return;
+        }
+
+        for (auto tile = 0; tile < n_tiles; tile++)
+        {
+            m_workers.enqueue_task([this, tile]()
+                                   { draw_tile(tile); });
+        }
+
+        m_workers.wait();
+    }
+
+    std::optional<Error> write_png(
+        const std::string &filename) const
+    {
+        auto file = std::fopen(filename.c_str(), "wb");
+
+        if (!file)
+        {
+            return Error("png", "unable to open " + filename);
+        }
+
+        auto png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+
+        auto info = png ? png_create_info_struct(png) : nullptr;
+
+        if (!info)
+        {
+            png_destroy_write_struct(&png, nullptr);
+
+            std::fclose(file);
+
+            return Error("png", "unable to create writer");
+        }
+
+        std::vector<png_bytep> rows(m_height);
+
+        for (auto y = 0; y < m_height; y++)
+        {
+            rows[y] = reinterpret_cast<png_bytep>(const_cast<uint32_t *>(m_color.data() + static_cast<size_t>(y) * m_width));
+        }
+
+        if (setjmp(png_jmpbuf(png)))
+        {
+            png_destroy_write_struct(&png, &info);
+
+            std::fclose(file);
+
+            return Error("png", "unable to write " + filename);
+        }
+
+        png_init_io(png, file);
+
+        png_set_IHDR(png, info, m_width, m_height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+        png_write_info(png, info);
+
+        png_write_image(png, rows.data());
+
+        png_write_end(png, nullptr);
+
+        png_destroy_write_struct(&png, &info);
+
+        std::fclose(file);
+
+        return std::nullopt;
+    }
+
+private:
+    // Screen space triangle, x and y in pixels and z the depth, wound so all three
+    // edge functions are positive inside, with the pixels it can cover
+
+    struct RasterTriangle
+    {
+        Triangle points;
+        int min_x;
+        int min_y;
+        int max_x;
+        int max_y;
+    };
+
+    static uint32_t pack(
+        uint8_t r,
+        uint8_t g,
+        uint8_t b,
+        uint8_t a)
+    {
+        return static_cast<uint32_t>(r) | (static_cast<uint32_t>(g) << 8) | (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(a) << 24);
+    }
+
+    static uint8_t to_byte(
+        float value)
+    {
+        return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+    }
+
+    void setup(
+        const std::vector<SDL_Vertex> &vertices,
+        const float *depths,
+        const std::vector<int> &indices)
+    {
+        for (auto i = 0; i + 2 < static_cast<int>(indices.size()); i += 3)
+        {
+            int index[3] = {indices[i], indices[i + 1], indices[i + 2]};
+
+            const auto edge = [&](int a, int b, float px, float py)
+            {
+                const auto &pa = vertices[index[a]].position;
+                const auto &pb = vertices[index[b]].position;
+
+                return (pb.x - pa.x) * (py - pa.y) - (pb.y - pa.y) * (px - pa.x);
+            };
+
+            const auto area = edge(0, 1, vertices[index[2]].position.x, vertices[index[2]].position.y);
+
+            if (area == 0.0f)
+            {
+                continue;
+            }
+
+            if (area < 0.0f)
+            {
+                std::swap(index[1], index[2]);
+            }
+
+            RasterTriangle triangle;
+
+            auto min_x = std::numeric_limits<float>::max();
+            auto min_y = std::numeric_limits<float>::max();
+            auto max_x = std::numeric_limits<float>::lowest();
+            auto max_y = std::numeric_limits<float>::lowest();
+
+            for (auto v = 0; v < 3; v++)
+            {
+                const auto &vertex = vertices[index[v]];
+
+                triangle.points.set_point_at(v, Vec4(vertex.position.x, vertex.position.y, depths ? depths[index[v]] : 0.0f));
+
+                min_x = std::min(min_x, vertex.position.x);
+                min_y = std::min(min_y, vertex.position.y);
+                max_x = std::max(max_x, vertex.position.x);
+                max_y = std::max(max_y, vertex.position.y);
+            }
+
+            // Pixels are sampled at their centres
+
+            triangle.min_x = std::max(0, static_cast<int>(std::ceil(min_x - 0.5f)));
+            triangle.min_y = std::max(0, static_cast<int>(std::ceil(min_y - 0.5f)));
+            triangle.max_x = std::min(m_width - 1, static_cast<int>(std::floor(max_x - 0.5f)));
+            triangle.max_y = std::min(m_height - 1, static_cast<int>(std::floor(max_y - 0.5f)));
+
+            if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y)
+            {
+                continue;
+            }
+
+            const auto &color = vertices[index[0]].color;
+
+            triangle.points.set_color(Color{to_byte(color.r), to_byte(color.g), to_byte(color.b), 0xff});
+
+            m_triangles.push_back(triangle);
+        }
+    }
+
+    void draw_tile(
+        int tile)
+    {
+        const auto x0 = (tile % m_tiles_x) * tile_size;
+        const auto y0 = (tile / m_tiles_x) * tile_size;
+        const auto x1 = std::min(x0 + tile_size, m_width) - 1;
+        const auto y1 = std::min(y0 + tile_size, m_height) - 1;
+
+        for (auto y = y0; y <= y1; y++)
+        {
+            const auto row = static_cast<size_t>(y) * m_width;
+
+            std::fill(m_color.begin() + row + x0, m_color.begin() + row + x1 + 1, m_clear_color);
+            std::fill(m_depth.begin() + row + x0, m_depth.begin() + row + x1 + 1, std::numeric_limits<float>::max());
+        }
+
+        const auto &bin = m_bins[tile];
+
+        const auto wireframe = std::lower_bound(bin.begin(), bin.end(), m_n_surface_triangles);
+
+        for (auto it = bin.begin(); it != wireframe; it++)
+        {
+            const auto &triangle = m_triangles[*it];
+
+            fill<true>(triangle, std::max(x0, triangle.min_x), std::max(y0, triangle.min_y), std::min(x1, triangle.max_x), std::min(y1, triangle.max_y));
+        }
+
+        for (auto it = wireframe; it != bin.end(); it++)
+        {
+            const auto &triangle = m_triangles[*it];
+
+            fill<false>(triangle, std::max(x0, triangle.min_x), std::max(y0, triangle.min_y), std::min(x1, triangle.max_x), std::min(y1, triangle.max_y));
+        }
+    }
+
+    // Edge functions are stepped across the rectangle, pixels on an edge shared by
+    // two triangles go to the one the edge is a top or left edge of
+
+    template <bool is_depth_tested>
+    void fill(
+        const RasterTriangle &triangle,
+        int x0,
+        int y0,
+        int x1,
+        int y1)
+    {
+        const auto &points = triangle.points;
+
+        const float x[3] = {points.point_at(0).x(), points.point_at(1).x(), points.point_at(2).x()};
+        const float y[3] = {points.point_at(0).y(), points.point_at(1).y(), points.point_at(2).y()};
+        const float z[3] = {points.point_at(0).z(), points.point_at(1).z(), points.point_at(2).z()};
+
+        const auto packed_color = pack(points.color().r, points.color().g, points.color().b, points.color().a);
+
+        float step_x[3];
+        float step_y[3];
+        float row_start[3];
+        bool is_top_left[3];
+
+        const auto px = static_cast<float>(x0) + 0.5f;
+        const auto py = static_cast<float>(y0) + 0.5f;
+
+        for (auto e = 0; e < 3; e++)
+        {
+            const auto a = (e + 1) % 3;
+            const auto b = (e + 2) % 3;
+
+            step_x[e] = -(y[b] - y[a]);
+            step_y[e] = x[b] - x[a];
+
+            row_start[e] = (x[b] - x[a]) * (py - y[a]) - (y[b] - y[a]) * (px - x[a]);
+
+            const auto is_top = y[a] == y[b] && x[b] > x[a];
+            const auto is_left = y[b] < y[a];
+
+            is_top_left[e] = is_top || is_left;
+        }
+
+        const auto is_inside = [&is_top_left](const float *w, int e)
+        {
+            return w[e] > 0.0f || (w[e] == 0.0f && is_top_left[e]);
+        };
+
+        const auto inverse_area = 1.0f / (row_start[0] + row_start[1] + row_start[2]);
+
+        for (auto py = y0; py <= y1; py++)
+        {
+            float w[3] = {row_start[0], row_start[1], row_start[2]};
+
+            auto *color = m_color.data() + static_cast<size_t>(py) * m_width;
+            auto *depth = m_depth.data() + static_cast<size_t>(py) * m_width;
+
+            for (auto px = x0; px <= x1; px++)
+            {
+                if (is_inside(w, 0) && is_inside(w, 1) && is_inside(w, 2))
+                {
+                    if constexpr (is_depth_tested)
+                    {
+                        const auto pixel_z = (w[0] * z[0] + w[1] * z[1] + w[2] * z[2]) * inverse_area;
+
+                        if (pixel_z < depth[px])
+                        {
+                            depth[px] = pixel_z;
+
+                            color[px] = packed_color;
+                        }
+                    }
+                    else
+                    {
+                        color[px] = packed_color;
+                    }
+                }
+
+                w[0] += step_x[0];
+                w[1] += step_x[1];
+                w[2] += step_x[2];
+            }
+
+            row_start[0] += step_y[0];
+            row_start[1] += step_y[1];
+            row_start[2] += step_y[2];
+        }
+    }
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_tiles_x = 0;
+    int m_tiles_y = 0;
+    uint32_t m_clear_color = 0;
+    int m_n_surface_triangles = 0;
+    std::vector<uint32_t> m_color;
+    std::vector<float> m_depth;
+    std::vector<RasterTriangle> m_triangles;
+    std::vector<std::vector<int>> m_bins;
+    WorkProcessor m_workers;
+};
+
+class Game
+{
+public:
+    enum class Backend
+    {
+        renderer, // SDL_RenderGeometry, triangles drawn back to front
+        software, // SoftwareRasterizer, shown through a streaming texture
+        headless  // SoftwareRasterizer with no window at all
+    };
+
+    static constexpr float near_plane = 0.1f;
+    static constexpr float far_plane = 1000.0f;
+
+    // The camera moves in fixed steps so its speed doesn't depend on how often
+    // input arrives, and a long stall like dragging the window only catches up
+    // to `max_catch_up` seconds
+
+    static constexpr float simulation_step = 1.0f / 120.0f;
+    static constexpr float max_catch_up = 0.25f;
+
+    // How long the update thread is still woken after the input last changed, long
+    // enough for a step to run and the interpolated pose to catch up with it
+
+    static constexpr Uint64 input_settle_time = static_cast<Uint64>(2.0 * simulation_step * 1.0e9);
+
+    Game(
+        int screen_width,
+        int screen_height,
+        int size,
+        Backend backend = Backend::renderer)
+    {
+        m_screen_width = screen_width;
+        m_screen_height = screen_height;
+
+        m_size = size;
+        m_size_f = static_cast<float>(m_size);
+
+        m_backend = backend;
+
+        if (m_backend != Backend::renderer)
+        {
+            m_rasterizer.emplace();
+        }
+
+        if (m_backend == Backend::headless)
+        {
+            m_scale = 1.0f;
+
+            m_width = static_cast<float>(m_screen_width);
+            m_height = static_cast<float>(m_screen_height);
+
+            m_pending_input.pixel_width = m_screen_width;
+            m_pending_input.pixel_height = m_screen_height;
+
+            m_camera = {};
+
+            return;
+        }
+
+        std::println("creating window");
+
+        m_window = SDL_CreateWindow(
+            "Game",
+            m_screen_width,
+            m_screen_height,
+            SDL_WINDOW_INPUT_FOCUS | SDL_WINDOW_MOUSE_FOCUS | SDL_WINDOW_HIGH_PIXEL_DENSITY);
+
+        ///
+
+        int window_size_width, window_size_height, window_size_pixels_width, window_size_pixels_height;
+
+        SDL_GetWindowSize(m_window, &window_size_width, &window_size_height);
+
+        SDL_GetWindowSizeInPixels(m_window, &window_size_pixels_width, &window_size_pixels_height);
+
+        ///
+
+        m_scale = static_cast<float>(window_size_pixels_width) / static_cast<float>(window_size_width);
+
+        ///
+
+        m_width = static_cast<float>(m_screen_width) * m_scale;
+        m_height = static_cast<float>(m_screen_height) * m_scale;
+
+        m_pending_input.pixel_width = static_cast<int>(m_width);
+        m_pending_input.pixel_height = static_cast<int>(m_height);
+
+        ///
+
+        m_renderer = SDL_CreateRenderer(m_window, nullptr);
+
+        SDL_SetRenderVSync(m_renderer, SDL_FALSE);
+
+        SDL_RaiseWindow(m_window);
+
+        ///
+
+        m_camera = {};
+    }
+
+    ~Game()
+    {
+        stop_update_thread();
+
+        if (m_texture)
+        {
+            SDL_DestroyTexture(m_texture);
+        }
+
+        if (m_renderer)
+        {
+            SDL_DestroyRenderer(m_renderer);
+        }
+
+        if (m_window)
+        {
+            SDL_DestroyWindow(m_window);
+        }
+    }
+
+    void reset_camera()
+    {
+        // m_camera = Vec4(8.0f, 9.51649f, 2.4497957f, 1.0f);
+        // m_camera = Vec4(m_size_f / 2.0f, m_size_f / 4.0f, 0.0f - (m_size_f / 16.0f), 1.0f);
+        // m_camera = Vec4(m_size_f / 2.0f, m_size_f / 4.0f, m_size_f / 32.0f, 1.0f);
+        // m_yaw = 0.0f;
+        // // m_pitch = 0.7708009f;
+        // m_pitch = 0.85f;
+        // m_roll = 0.0f;
+
+        // m_camera = Vec4(64.0f, 7.028963f, 10.614152f, 1.0f);
+        // m_yaw = 0.0f;
+        // m_pitch = 0.6240001f;
+        // m_roll = 0.0f;
+
+        // best for 48x48
+        m_camera = Vec4(24.0f, 26.66f, 1.38f, 1.0f);
+        m_yaw = 0.0f;
+        m_pitch = 0.93f;
+        m_roll = 0.0f;
+    }
+
+    void on_create()
+    {
+        const auto height_map = Mesh::generate_height_map(m_size); // sc2k
+        // const auto height_map = Mesh::generate_height_map(256); // sc4
+
+        m_terrain = Terrain::create_from_height_map(height_map);
+
+        m_mesh = Mesh::create_from_height_map(height_map, m_terrain->levels());
+
+        m_eye.set_projection(90.0f, m_height / m_width, near_plane, far_plane);
+
+        ///
+
+        reset_camera();
+    }
+
+    // Replace the terrain with a model loaded from an OBJ file, placed in front of
+    // a camera at the origin
+
+    std::optional<Error> load_model(
+        const std::string &filename)
+    {
+        auto result = Mesh::load_from_obj_file(filename);
+
+        if (std::holds_alternative<Error>(result))
+        {
+            return std::get<Error>(result);
+        }
+
+        m_mesh = std::move(std::get<Mesh>(result));
+
+        m_terrain.reset();
+
+        m_camera = Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        m_yaw = 0.0f;
+        m_pitch = 0.0f;
+        m_roll = 0.0f;
+
+        m_frame_dirty = true;
+
+        return std::nullopt;
+    }
+
+    void print_camera()
+    {
+        std::println("camera = Vec4(x: {0}f, y: {1}f, z: {2}f, w: {3}f);", m_camera.x(), m_camera.y(), m_camera.z(), m_camera.w());
+        std::println("yaw = {0}f;", m_yaw);
+        std::println("pitch = {0}f;", m_pitch);
+        std::println("roll = {0}f;", m_roll);
+        std::println("look direction = Vec4(x: {0}f, y: {1}f, z: {2}f, w: {3}f);", m_eye.look_direction().x(), m_eye.look_direction().y(), m_eye.look_direction().z(), m_eye.look_direction().w());
+        std::println("");
+    }
+
+    // Present in step with the display's refresh, false if the renderer can't
+
+    bool enable_vsync()
+    {
+        return SDL_SetRenderVSync(m_renderer, 1) == 0;
+    }
+
+    // Camera movement and geometry run on their own thread, so a slow rebuild
+    // never holds up event handling or presenting the last finished frame
+
+    void start_update_thread()
+    {
+        m_frame_event = SDL_RegisterEvents(1);
+
+        m_update_thread = std::thread(&Game::update_thread, this);
+    }
+
+    void stop_update_thread()
+    {
+        if (!m_update_thread.joinable())
+        {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_input_mutex);
+
+            m_stop_update = true;
+        }
+
+        m_input_changed.notify_one();
+
+        m_update_thread.join();
+    }
+
+    // Main thread side of the input hand off, events are collected into the
+    // pending input which is submitted once per loop
+
+    void on_mouse_wheel(
+        float y)
+    {
+        if (y > 0)
+        {
+            m_pending_input.wheel_steps++;
+        }
+        else if (y < 0)
+        {
+            m_pending_input.wheel_steps--;
+        }
+    }
+
+    void on_reset()
+    {
+        m_pending_input.reset_camera = true;
+    }
+
+    void on_resize()
+    {
+        SDL_GetWindowSizeInPixels(m_window, &m_pending_input.pixel_width, &m_pending_input.pixel_height);
+
+        m_needs_redraw = true;
+    }
+
+    void on_expose()
+    {
+        m_needs_redraw = true;
+    }
+
+    // The update thread is only woken when the input changed, while a key is held
+    // and for `input_settle_time` after either, so a still view leaves it asleep
+
+    void submit_input()
+    {
+        const auto keyboard_state = SDL_GetKeyboardState(nullptr);
+
+        std::copy(keyboard_state, keyboard_state + SDL_NUM_SCANCODES, m_pending_input.keys.begin());
+
+        const auto now = SDL_GetTicksNS();
+
+        {
+            std::unique_lock<std::mutex> lock(m_input_mutex);
+
+            const auto is_changed = m_pending_input.keys != m_input.keys ||
+                                    m_pending_input.wheel_steps != 0 ||
+                                    m_pending_input.reset_camera ||
+                                    m_pending_input.pixel_width != m_input.pixel_width ||
+                                    m_pending_input.pixel_height != m_input.pixel_height;
+
+            const auto is_key_held = std::any_of(m_pending_input.keys.begin(), m_pending_input.keys.end(), [](Uint8 key)
+                                                 { return key != 0; });
+
+            if (is_changed || is_key_held)
+            {
+                m_input_active_until = now + input_settle_time;
+            }
+
+            if (now >= m_input_active_until)
+            {
+                return;
+            }
+
+            m_input.keys = m_pending_input.keys;
+            m_input.wheel_steps += m_pending_input.wheel_steps;
+            m_input.reset_camera = m_input.reset_camera || m_pending_input.reset_camera;
+            m_input.pixel_width = m_pending_input.pixel_width;
+            m_input.pixel_height = m_pending_input.pixel_height;
+
+            m_input_sequence++;
+        }
+
+        m_input_changed.notify_one();
+
+        m_pending_input.wheel_steps = 0;
+        m_pending_input.reset_camera = false;
+    }
+
+    // Whether submitted input may still move the camera, the main loop waits for
+    // events instead of polling once it can't
+
+    bool is_input_active() const
+    {
+        return SDL_GetTicksNS() < m_input_active_until;
+    }
+
+    void on_update(
+        float elapsed,
+        const InputState &input)
+    {
+        simulate(elapsed, input);
+
+        rebuild_frame_if_changed();
+    }
+
+    // Move the camera by `elapsed` seconds of the held keys
+
+    void simulate(
+        float elapsed,
+        const InputState &input)
+    {
+        if (input.pixel_width > 0 && input.pixel_height > 0 &&
+            (static_cast<float>(input.pixel_width) != m_width || static_cast<float>(input.pixel_height) != m_height))
+        {
+            m_width = static_cast<float>(input.pixel_width);
+            m_height = static_cast<float>(input.pixel_height);
+
+            m_eye.set_projection(90.0f, m_height / m_width, near_plane, far_plane);
+
+            m_frame_dirty = true;
+        }
+
+        if (input.reset_camera)
+        {
+            reset_camera();
+        }
+
+        if (input.wheel_steps != 0)
+        {
+            const auto steps = static_cast<float>(input.wheel_steps);
+
+            const auto c = Vec4::subtract(m_camera, Vec4::multiply(m_eye.look_direction(), 8.0f * elapsed * steps));
+
+            m_camera = Vec4(c.x(), c.y() + (8.0f * elapsed * steps), c.z(), c.w());
+        }
+
+        ///
+
+        const auto c1 = m_camera;
+
+        const auto yaw_start = m_yaw;
+
+        const auto pitch_start = m_pitch;
+
+        const auto roll_start = m_roll;
+
+        ///
+
+        const auto height_ratio = m_camera.y() / (m_size_f / 2.0f);
+
+        const auto min_speed = 0.125f;
+
+        const auto move_speed = (height_ratio * (1.0f - min_speed) + min_speed);
+
+        ///
+
+        const auto &keyboard_state = input.keys;
+
+        if (keyboard_state[SDL_SCANCODE_UP])
+        {
+            m_camera = Vec4(m_camera.x(), m_camera.y() + (8.0f * elapsed), m_camera.z(), m_camera.w());
+        }
+
+        if (keyboard_state[SDL_SCANCODE_DOWN])
+        {
+            m_camera = Vec4(m_camera.x(), m_camera.y() - (8.0f * elapsed), m_camera.z(), m_camera.w());
+        }
+
+        ///
+
+        if (keyboard_state[SDL_SCANCODE_LEFT])
+        {
+            m_camera = Vec4(m_camera.x() + (8.0f * elapsed), m_camera.y(), m_camera.z(), m_camera.w());
+        }
+
+        if (keyboard_state[SDL_SCANCODE_RIGHT])
+        {
+            m_camera = Vec4(m_camera.x() - (8.0f * elapsed), m_camera.y(), m_camera.z(), m_camera.w());
+        }
+
+        ///
+
+        const auto forward = Vec4::multiply(m_eye.look_direction(), std::exp(std::exp(m_pitch) - 1.0f) * 8.0f * elapsed * move_speed);
+
+        if (keyboard_state[SDL_SCANCODE_W])
+        {
+            const auto w = Vec4::add(m_camera, forward);
+
+            m_camera = Vec4(w.x(), m_camera.y(), w.z(), w.w());
+        }
+
+        if (keyboard_state[SDL_SCANCODE_S])
+        {
+            const auto s = Vec4::subtract(m_camera, forward);
+
+            m_camera = Vec4(s.x(), m_camera.y(), s.z(), s.w());
+        }
+
+        ///
+
+        if (keyboard_state[SDL_SCANCODE_Q])
+        {
+            m_yaw += 2.0f * elapsed;
+        }
+
+        if (keyboard_state[SDL_SCANCODE_E])
+        {
+            m_yaw -= 2.0f * elapsed;
+        }
+
+        ///
+
+        const auto up = Vec4(0.0f, 1.0f, 0.0f, 1.0f);
+
+        const auto direction = Vec4::cross_product(up, forward);
+
+        ///
+
+        if (keyboard_state[SDL_SCANCODE_A])
+        {
+            m_camera = Vec4(m_camera.x() + direction.x(), m_camera.y(), m_camera.z() + direction.z(), m_camera.w());
+        }
+
+        if (keyboard_state[SDL_SCANCODE_D])
+        {
+            m_camera = Vec4(m_camera.x() - direction.x(), m_camera.y(), m_camera.z() - direction.z(), m_camera.w());
+        }
+
+        ///
+
+        if (keyboard_state[SDL_SCANCODE_T])
+        {
+            m_camera = Vec4::add(m_camera, forward);
+            m_camera = Vec4(m_camera.x(), m_camera.y() - (8.0f * elapsed), m_camera.z(), m_camera.w());
+        }
+
+        if (keyboard_state[SDL_SCANCODE_G])
+        {
+            m_camera = Vec4::subtract(m_camera, forward);
+            m_camera = Vec4(m_camera.x(), m_camera.y() + (8.0f * elapsed), m_camera.z(), m_camera.w());
+        }
+
+        ///
+
+        if (keyboard_state[SDL_SCANCODE_U])
+        {
+            m_pitch -= 2.0f * elapsed;
+        }
+
+        if (keyboard_state[SDL_SCANCODE_J])
+        {
+            m_pitch += 2.0f * elapsed;
+        }
+
+        m_pitch = std::min(std::max(0.0f, m_pitch), 1.5f);
+
+        ///
+
+        if (m_camera.y() < 0.5f)
+        {
+            m_camera = Vec4(m_camera.x(), 0.5f, m_camera.z(), m_camera.w());
+        }
+
+        ///
+
+        // Printing runs at the simulation rate, so it's only done when asked for
+
+        if (m_print_camera && (c1.x() != m_camera.x() || c1.y() != m_camera.y() || c1.z() != m_camera.z() || c1.w() != m_camera.w() || yaw_start != m_yaw || pitch_start != m_pitch || roll_start != m_roll))
+        {
+            print_camera();
+        }
+    }
+
+    // Only rebuild the frame's geometry when something it depends on has changed,
+    // otherwise the retained vertex buffer from the last rebuild is drawn again.
+    // True if a new frame was published
+
+    bool rebuild_frame_if_changed()
+    {
+        update_camera();
+
+        const auto mesh_revision = m_mesh.has_value() ? m_mesh->revision() : 0;
+
+        if (m_frame_dirty ||
+            m_frame_camera_revision != m_eye.revision() ||
+            m_frame_mesh_revision != mesh_revision)
+        {
+            build_frame();
+
+            m_frame_camera_revision = m_eye.revision();
+            m_frame_mesh_revision = mesh_revision;
+            m_frame_dirty = false;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    // Hand the pose and world matrix to the camera, which recomputes only what
+    // they change
+
+    void update_camera()
+    {
+        const auto rotation_z = Matrix4x4::make_rotation_z(m_theta * 0.5f);
+
+        const auto rotation_x = Matrix4x4::make_rotation_x(m_theta);
+
+        const auto translation = Matrix4x4::make_translation(0.0f, 0.0f, 10.0f); // TODO: explore diff values?
+
+        m_eye.set_world(Matrix4x4::multiply(rotation_z, rotation_x, translation));
+
+        m_eye.set_pose(m_camera, m_yaw, m_pitch, m_roll);
+
+        m_eye.update();
+    }
+
+    // Waits for each new input snapshot from the main thread, so it runs no faster
+    // than events are polled and sleeps while the main thread is idle. Whatever
+    // time has built up is simulated in fixed steps, and the frame is built at the
+    // pose part way from the previous step to the last one by the time left over
+
+    void update_thread()
+    {
+        auto sequence = uint64_t{0};
+
+        auto t1 = SDL_GetTicksNS();
+
+        auto accumulator = 0.0f;
+
+        auto previous = camera_pose(simulation_step);
+
+        // Wheel steps and resets are held until a step runs, then applied once
+
+        auto wheel_steps = 0;
+
+        auto reset_camera = false;
+
+        while (true)
+        {
+            InputState input;
+
+            {
+                std::unique_lock<std::mutex> lock(m_input_mutex);
+
+                m_input_changed.wait(lock, [&]()
+                                     { return m_stop_update || m_input_sequence != sequence; });
+
+                if (m_stop_update)
+                {
+                    return;
+                }
+
+                sequence = m_input_sequence;
+
+                input = m_input;
+
+                m_input.wheel_steps = 0;
+                m_input.reset_camera = false;
+            }
+
+            const auto t2 = SDL_GetTicksNS();
+
+            const auto elapsed = static_cast<float>(static_cast<double>(t2 - t1) / 1.0e9);
+
+            t1 = t2;
+
+            accumulator += std::min(elapsed, max_catch_up);
+
+            wheel_steps += input.wheel_steps;
+
+            reset_camera = reset_camera || input.reset_camera;
+
+            while (accumulator >= simulation_step)
+            {
+                input.wheel_steps = std::exchange(wheel_steps, 0);
+                input.reset_camera = std::exchange(reset_camera, false);
+
+                previous = camera_pose(simulation_step);
+
+                simulate(simulation_step, input);
+
+                // Jump straight to a reset camera rather than sweeping over to it
+
+                if (input.reset_camera)
+                {
+                    previous = camera_pose(simulation_step);
+                }
+
+                accumulator -= simulation_step;
+            }
+
+            ///
+
+            const auto current = camera_pose(simulation_step);
+
+            set_camera_pose(CameraPose::interpolate(previous, current, accumulator / simulation_step));
+
+            // Wake the main thread, which may be waiting for events, to draw it
+
+            if (rebuild_frame_if_changed())
+            {
+                SDL_Event event = {};
+
+                event.type = m_frame_event;
+
+                SDL_PushEvent(&event);
+            }
+
+            // What was drawn is what gets replayed
+
+            if (m_is_recording)
+            {
+                m_recording.add(camera_pose(elapsed));
+            }
+
+            set_camera_pose(current);
+        }
+    }
+
+    // Project, light, sort and clip the mesh into the retained frame buffers
+
+    void build_frame()
+    {
+        // Timings go out with the frame, the main thread adds them to the profiler
+        // once it draws it
+
+        auto &profile = m_frames.back().profile;
+
+        profile = {};
+
+        auto timer = Profiler::Timer(profile, Profiler::Stage::visibility);
+
+        // rebuild_frame_if_changed has already brought the camera's transforms up
+        // to date. Lighting, back-face and distance tests are done in model space, so
+        // the camera and light are brought into it instead of moving every vertex
+        // into world space
+
+        const auto &world_view_projection = m_eye.world_view_projection();
+
+        const auto &model_camera = m_eye.model_position();
+
+        const auto light_direction = Vec4::normalize(Matrix4x4::multiply_direction(m_eye.inverse_world(), Vec4(0.0f, 1.0f, -1.0f, 1.0f)));
+
+        ///
+
+        // Every scratch buffer comes from the frame arena, which keeps its capacity
+        // between frames
+
+        m_arena.clear();
+
+        // Screen space vertices, the mesh's shared vertices first followed by any
+        // created by clipping
+
+        auto &projected_vertices = m_arena.projected_vertices;
+
+        auto &triangles = m_arena.triangles;
+
+        ClipSpaceClipper::Stats clip_stats;
+
+        auto n_visible_chunks = 0;
+
+        auto n_occluded_chunks = 0;
+
+        auto n_visible_meshlets = 0;
+
+        auto n_culled_meshlets = 0;
+
+        auto n_mesh_vertices = 0;
+
+        auto n_mesh_triangles = 0;
+
+        auto is_ordered = false;
+
+        if (m_mesh.has_value())
+        {
+            const auto &mesh_vertices = m_mesh->vertices();
+            const auto &mesh_indices = m_mesh->indices();
+            const auto &mesh_colors = m_mesh->colors();
+
+            n_mesh_vertices = static_cast<int>(mesh_vertices.size());
+
+            const auto n_triangles = m_mesh->triangle_count();
+
+            n_mesh_triangles = n_triangles;
+
+            // Terrain gets coarser with distance, so it is drawn out to the far plane.
+            // Anything else stops at a distance that grows with the camera's height
+
+            const auto max_distance = m_terrain.has_value() ? far_plane : 75.0f + (m_camera.y() * 2.0f);
+
+            // Work out which parts of the mesh can be seen at all. Terrain rejects
+            // whole chunks against the view frustum, meshes with meshlets reject whole
+            // meshlets, anything else is processed whole
+
+            auto &vertex_ranges = m_arena.vertex_ranges;
+
+            auto &triangle_ranges = m_arena.triangle_ranges;
+
+            // Terrain chunks come back from far to near and their triangles can be
+            // walked in painter's order, so they never need sorting
+
+            auto &triangle_order = m_arena.triangle_order;
+
+            if (m_terrain.has_value())
+            {
+                auto &visible_chunks = m_arena.visible_chunks;
+
+                m_terrain->find_visible_chunks(m_eye.frustum(), model_camera, max_distance, visible_chunks);
+
+                // Walk the chunks from the front, dropping any hidden behind nearer
+                // ones. Only chunks that will be drawn whole can hide others
+
+                if (m_occlusion_culling && m_terrain->is_above_surface(model_camera, near_plane))
+                {
+                    auto &occlusion = m_arena.occlusion;
+
+                    occlusion.clear(m_width, m_height);
+
+                    for (auto c = static_cast<int>(visible_chunks.size()) - 1; c >= 0; c--)
+                    {
+                        const auto chunk = visible_chunks[c];
+
+                        // Every level of detail stays within the chunk's bounds
+
+                        Vec4 min, max;
+
+                        m_terrain->bounds(chunk, min, max);
+
+                        if (occlusion.is_occluded(world_view_projection, min, max))
+                        {
+                            visible_chunks[c] = -1;
+
+                            n_occluded_chunks++;
+
+                            continue;
+                        }
+
+                        if (m_terrain->is_within(chunk, model_camera, max_distance))
+                        {
+                            auto &boxes = m_arena.occluder_boxes;
+
+                            boxes.clear();
+
+                            m_terrain->append_occluders(chunk, model_camera, boxes);
+
+                            for (auto i = 0; i < static_cast<int>(boxes.size()); i += 2)
+                            {
+                                occlusion.add_occluder(world_view_projection, boxes[i], boxes[i + 1]);
+                            }
+                        }
+                    }
+
+                    std::erase(visible_chunks, -1);
+                }
+
+                n_visible_chunks = static_cast<int>(visible_chunks.size());
+
+                for (const auto chunk : visible_chunks)
+                {
+                    const auto level = m_terrain->lod_level(chunk, model_camera);
+
+                    m_terrain->chunk_ranges(chunk, level, vertex_ranges, triangle_ranges);
+
+                    m_terrain->append_back_to_front(chunk, level, model_camera, triangle_order);
+                }
+
+                is_ordered = true;
+            }
+            else if (!m_mesh->meshlets().empty())
+            {
+                // Meshlets entirely off screen, out of range or facing away are
+                // dropped before any of their triangles are looked at
+
+                const auto &frustum = m_eye.frustum();
+
+                const auto &meshlet_vertex_ranges = m_mesh->meshlet_vertex_ranges();
+
+                for (const auto &meshlet : m_mesh->meshlets())
+                {
+                    if (frustum.test_box(meshlet.min, meshlet.max) == Frustum::Containment::outside ||
+                        Vec4::distance(meshlet.center, model_camera) - meshlet.radius > max_distance ||
+                        meshlet.is_backfacing(model_camera))
+                    {
+                        n_culled_meshlets++;
+
+                        continue;
+                    }
+
+                    n_visible_meshlets++;
+
+                    for (auto r = meshlet.first_vertex_range; r < meshlet.first_vertex_range + meshlet.vertex_range_count; r++)
+                    {
+                        vertex_ranges.push_back(meshlet_vertex_ranges[r]);
+                    }
+
+                    triangle_ranges.push_back(IndexRange{meshlet.first_triangle, meshlet.triangle_count});
+
+                    for (auto i = meshlet.first_triangle; i < meshlet.first_triangle + meshlet.triangle_count; i++)
+                    {
+                        triangle_order.push_back(i);
+                    }
+                }
+            }
+            else
+            {
+                vertex_ranges.push_back(IndexRange{0, n_mesh_vertices});
+
+                triangle_ranges.push_back(IndexRange{0, n_triangles});
+
+                triangle_order.resize(n_triangles);
+
+                for (auto i = 0; i < n_triangles; i++)
+                {
+                    triangle_order[i] = i;
+                }
+            }
+
+            timer.next(Profiler::Stage::transform);
+
+            // Chunks share their edge rows and columns, merge overlapping vertex
+            // ranges so every vertex is transformed by exactly one worker
+
+            std::sort(vertex_ranges.begin(), vertex_ranges.end(), [](const IndexRange &a, const IndexRange &b)
+                      { return a.first < b.first; });
+
+            auto n_merged = 0;
+
+            for (const auto &range : vertex_ranges)
+            {
+                if (n_merged > 0 && range.first <= vertex_ranges[n_merged - 1].first + vertex_ranges[n_merged - 1].count)
+                {
+                    auto &last = vertex_ranges[n_merged - 1];
+
+                    last.count = std::max(last.count, range.first + range.count - last.first);
+                }
+                else
+                {
+                    vertex_ranges[n_merged++] = range;
+                }
+            }
+
+            vertex_ranges.resize(n_merged);
+
+            // Transform each shared vertex once, the ranges split across the workers.
+            // Terrain heights are morphed between levels of detail on the way, and
+            // everything after works from the morphed heights
 
-                    auto light_direction = Vec4(0.0f, 1.0f, -1.0f, 1.0f);
+            projected_vertices.resize(n_mesh_vertices);
+
+            const auto &xs = m_mesh->xs();
+            const auto &zs = m_mesh->zs();
+
+            auto ys = m_mesh->ys().data();
+
+            const float *morphs = nullptr;
+
+            if (m_terrain.has_value())
+            {
+                m_arena.heights.resize(n_mesh_vertices);
+                m_arena.morphs.resize(n_mesh_vertices);
+
+                ys = m_arena.heights.data();
+
+                morphs = m_arena.morphs.data();
+            }
+
+            auto n_slices = slice_count(n_mesh_vertices);
+
+            split_ranges(vertex_ranges, n_slices, m_arena.pieces, m_arena.piece_bounds);
+
+            run_slices(n_slices, [&](int slice)
+                       {
+                for (auto p = m_arena.piece_bounds[slice]; p < m_arena.piece_bounds[slice + 1]; p++)
+                {
+                    const auto &range = m_arena.pieces[p];
+
+                    if (m_terrain.has_value())
+                    {
+                        m_terrain->morph_heights(model_camera, m_mesh->ys().data(), range.first, range.count, m_arena.heights.data(), m_arena.morphs.data());
+                    }
+
+                    projected_vertices.transform(world_view_projection, xs.data(), ys, zs.data(), range.first, range.count, m_width, m_height);
+
+                    projected_vertices.classify(range.first, range.count);
+                } });
+
+            timer.next(Profiler::Stage::clip);
+
+            // Normals and lit colours come from the mesh, which only recomputes them
+            // when it or the light has changed
+
+            const auto &base_ys = m_mesh->ys();
+
+            const auto &normal_xs = m_mesh->normal_xs();
+            const auto &normal_ys = m_mesh->normal_ys();
+            const auto &normal_zs = m_mesh->normal_zs();
+
+            const auto &lit_colors = m_mesh->lit_colors(light_direction);
+
+            ///
+
+            // Cull, light and clip contiguous runs of the triangle order in parallel,
+            // each into its own slice
+
+            const auto n_ordered = static_cast<int>(triangle_order.size());
+
+            profile.triangles_in = n_ordered;
+
+            n_slices = slice_count(n_ordered);
+
+            auto &slices = m_arena.slices;
+
+            if (static_cast<int>(slices.size()) < n_slices)
+            {
+                slices.resize(n_slices);
+            }
+
+            run_slices(n_slices, [&](int s)
+                       {
+                auto &slice = slices[s];
+
+                slice.clear();
+
+                auto &clipper = slice.clipper;
+
+                const auto begin = static_cast<int>(static_cast<int64_t>(n_ordered) * s / n_slices);
+                const auto end = static_cast<int>(static_cast<int64_t>(n_ordered) * (s + 1) / n_slices);
+
+                const auto screen_codes = projected_vertices.screen_codes();
+                const auto guard_codes = projected_vertices.guard_codes();
+
+                for (auto t = begin; t < end; t += 8)
+                {
+                    const auto n_lanes = std::min(8, end - t);
+
+                    // Nothing to do for triangles entirely off screen or beyond the near or far
+                    // planes, the rest are taken in order
+
+                    const auto batch = clipper.test_batch(screen_codes, guard_codes, mesh_indices.data(), triangle_order.data() + t, n_lanes);
+
+                    slice.culled += std::popcount(batch.rejected);
+
+                    for (auto survivors = ((1u << n_lanes) - 1u) & ~batch.rejected; survivors != 0; survivors &= survivors - 1)
+                    {
+                        const auto lane = std::countr_zero(survivors);
+
+                        const auto i = triangle_order[t + lane];
+
+                        const auto i0 = mesh_indices[i * 3 + 0];
+                        const auto i1 = mesh_indices[i * 3 + 1];
+                        const auto i2 = mesh_indices[i * 3 + 2];
+
+                        const auto p0 = Vec4(xs[i0], ys[i0], zs[i0]);
+
+                        // Skip anything beyond the draw distance
+
+                        if (Vec4::distance(p0, model_camera) > max_distance)
+                        {
+                            slice.culled++;
+
+                            continue;
+                        }
+
+                        // A triangle with morphed vertices is no longer the mesh's own, so its
+                        // normal is worked out afresh
+
+                        const auto is_morphed = ys != base_ys.data() && (ys[i0] != base_ys[i0] || ys[i1] != base_ys[i1] || ys[i2] != base_ys[i2]);
+
+                        auto normal = Vec4(normal_xs[i], normal_ys[i], normal_zs[i]);
+
+                        if (is_morphed)
+                        {
+                            const auto p1 = Vec4(xs[i1], ys[i1], zs[i1]);
+                            const auto p2 = Vec4(xs[i2], ys[i2], zs[i2]);
+
+                            normal = Vec4::normalize(Vec4::cross_product(Vec4::subtract(p1, p0), Vec4::subtract(p2, p0)));
+                        }
+
+                        // Get Ray from triangle to camera
+
+                        const auto camera_ray = Vec4::subtract(p0, model_camera);
+
+                        // If ray is aligned with normal, then triangle is visible
+
+                        if (Vec4::dot_product(normal, camera_ray) >= 0.0f)
+                        {
+                            slice.culled++;
+
+                            continue;
+                        }
+
+                        // Illumination. Morphing triangles fade towards the colour of the coarser
+                        // triangle they become part of, so it doesn't pop at the switch
+
+                        const auto morph = morphs != nullptr ? std::max({morphs[i0], morphs[i1], morphs[i2]}) : 0.0f;
+
+                        const auto lit_color = morph > 0.0f ? Mesh::light_color(Mesh::blend_color(mesh_colors[i], mesh_colors[m_terrain->parent_triangle(i)], morph), normal, light_direction) : lit_colors[i];
+
+                        // Triangles inside the guard band keep their shared vertices and are left
+                        // for the renderer to clip against the screen edges
+
+                        if ((batch.accepted & (1u << lane)) != 0)
+                        {
+                            slice.triangles.push_back(IndexedTriangle{{i0, i1, i2}, lit_color, average_depth(projected_vertices, i0, i1, i2), i});
+
+                            continue;
+                        }
+
+                        // The rest are clipped while still homogeneous, then divided and fanned out
+                        // from the polygon's first vertex. Their vertices are numbered as if the
+                        // slice's batch followed straight after the mesh's
+
+                        Vec4 polygon[ClipSpaceClipper::max_vertices];
+
+                        const auto polygon_count = clipper.clip(
+                            projected_vertices.clip_point(i0),
+                            projected_vertices.clip_point(i1),
+                            projected_vertices.clip_point(i2),
+                            guard_codes[i0] | guard_codes[i1] | guard_codes[i2],
+                            polygon);
+
+                        const auto first = slice.vertices.size();
+
+                        for (auto v = 0; v < polygon_count; v++)
+                        {
+                            slice.vertices.push_clip(polygon[v], m_width, m_height);
+                        }
+
+                        for (auto v = 1; v + 1 < polygon_count; v++)
+                        {
+                            const auto depth = average_depth(slice.vertices, first, first + v, first + v + 1);
+
+                            slice.triangles.push_back(IndexedTriangle{{n_mesh_vertices + first, n_mesh_vertices + first + v, n_mesh_vertices + first + v + 1}, lit_color, depth, i});
+                        }
+                    }
+                } });
+
+            // Merge the slices in order, renumbering clipped vertices past everything
+            // merged before them. This gives exactly the single threaded result
+
+            for (auto s = 0; s < n_slices; s++)
+            {
+                const auto &slice = slices[s];
+
+                const auto offset = projected_vertices.size() - n_mesh_vertices;
+
+                projected_vertices.append(slice.vertices);
+
+                for (auto t : slice.triangles)
+                {
+                    for (auto &index : t.indices)
+                    {
+                        if (index >= n_mesh_vertices)
+                        {
+                            index += offset;
+                        }
+                    }
+
+                    triangles.push_back(t);
+                }
+
+                const auto &stats = slice.clipper.stats();
+
+                clip_stats.accepted += stats.accepted;
+                clip_stats.rejected += stats.rejected;
+                clip_stats.clipped += stats.clipped;
+
+                profile.triangles_culled += slice.culled;
+            }
+
+            profile.triangles_emitted = static_cast<int>(triangles.size());
+        }
+
+        timer.next(Profiler::Stage::sort);
+
+        // Sort triangles from back to front, only the order is sorted and the
+        // triangles themselves stay where they are. The software rasterizer has a
+        // depth buffer and doesn't need it
+
+        const std::vector<int> *draw_order = nullptr;
+
+        if (!is_ordered && !m_rasterizer.has_value())
+        {
+            draw_order = &m_depth_sorter.sort(triangles, n_mesh_triangles);
+        }
+
+        ///
+
+        SDL_FPoint zero_text_coord = {};
+
+        ///
+
+        timer.next(Profiler::Stage::vertices);
+
+        // Everything is clipped by now, only the draw order is left to apply
+
+        auto &batched_triangles = m_arena.batched_triangles;
+
+        for (auto t = 0; t < static_cast<int>(triangles.size()); t++)
+        {
+            batched_triangles.push_back(triangles[draw_order ? (*draw_order)[t] : t]);
+        }
+
+        ///
+
+        // Mesh vertices are emitted once and then referenced by index for as long as
+        // the triangles sharing them are lit the same colour
+
+        // Built into the back buffer, which is published to the renderer once complete
+
+        auto &back = m_frames.back();
+
+        back.clip_stats = clip_stats;
+
+        back.visible_chunks = n_visible_chunks;
+        back.occluded_chunks = n_occluded_chunks;
+
+        back.visible_meshlets = n_visible_meshlets;
+        back.culled_meshlets = n_culled_meshlets;
+
+        back.width = static_cast<int>(m_width);
+        back.height = static_cast<int>(m_height);
+
+        auto &vertices = back.vertices;
+
+        auto &vertex_indices = back.indices;
+
+        auto &depths = back.depths;
+
+        vertices.clear();
+
+        vertex_indices.clear();
+
+        depths.clear();
+
+        auto &shared_vertices = m_arena.shared_vertices;
+
+        shared_vertices.assign(n_mesh_vertices, -1);
+
+        for (const auto &t : batched_triangles)
+        {
+            SDL_FColor color{static_cast<float>(t.color.r) / 255.0f, static_cast<float>(t.color.g) / 255.0f, static_cast<float>(t.color.b) / 255.0f, static_cast<float>(t.color.a) / 255.0f};
+
+            for (const auto index : t.indices)
+            {
+                if (index < n_mesh_vertices)
+                {
+                    const auto shared = shared_vertices[index];
+
+                    if (shared >= 0 && is_same_color(vertices[shared].color, color))
+                    {
+                        vertex_indices.push_back(shared);
+
+                        continue;
+                    }
+
+                    shared_vertices[index] = static_cast<int>(vertices.size());
+                }
+
+                vertex_indices.push_back(static_cast<int>(vertices.size()));
+
+                vertices.push_back(SDL_Vertex{SDL_FPoint{projected_vertices.screen_x()[index], projected_vertices.screen_y()[index]}, color, zero_text_coord});
+
+                depths.push_back(projected_vertices.screen_z()[index]);
+            }
+        }
+
+        ///
+
+        timer.next(Profiler::Stage::wireframe);
+
+        // Wireframe, every edge once no matter how many triangles share it, as a
+        // one pixel wide quad so the whole overlay is a single geometry call
+
+        const auto wireframe_color = SDL_FColor{0.0f, 0.0f, 0.0f, static_cast<float>(0x07) / 255.0f};
+
+        auto &edges = m_arena.edges;
+
+        edges.clear(static_cast<int>(batched_triangles.size()) * 3);
+
+        back.wireframe_vertices.clear();
+
+        back.wireframe_indices.clear();
+
+        for (const auto &it : batched_triangles)
+        {
+            for (auto e = 0; e < 3; e++)
+            {
+                const auto a = it.indices[e];
+                const auto b = it.indices[(e + 1) % 3];
+
+                if (!edges.insert(EdgeSet::key(a, b)))
+                {
+                    continue;
+                }
+
+                const auto ax = projected_vertices.screen_x()[a];
+                const auto ay = projected_vertices.screen_y()[a];
+                const auto bx = projected_vertices.screen_x()[b];
+                const auto by = projected_vertices.screen_y()[b];
+
+                const auto length = std::sqrt((bx - ax) * (bx - ax) + (by - ay) * (by - ay));
+
+                if (length == 0.0f)
+                {
+                    continue;
+                }
+
+                // Half a pixel either side of the edge
+
+                const auto nx = -(by - ay) / length * 0.5f;
+                const auto ny = (bx - ax) / length * 0.5f;
+
+                const auto first = static_cast<int>(back.wireframe_vertices.size());
+
+                back.wireframe_vertices.push_back(SDL_Vertex{SDL_FPoint{ax + nx, ay + ny}, wireframe_color, zero_text_coord});
+                back.wireframe_vertices.push_back(SDL_Vertex{SDL_FPoint{ax - nx, ay - ny}, wireframe_color, zero_text_coord});
+                back.wireframe_vertices.push_back(SDL_Vertex{SDL_FPoint{bx - nx, by - ny}, wireframe_color, zero_text_coord});
+                back.wireframe_vertices.push_back(SDL_Vertex{SDL_FPoint{bx + nx, by + ny}, wireframe_color, zero_text_coord});
+
+                for (const auto index : {0, 1, 2, 0, 2, 3})
+                {
+                    back.wireframe_indices.push_back(first + index);
+                }
+            }
+        }
+
+        timer.stop();
+
+        m_frames.publish();
+    }
+
+    // Draw the latest published frame. With nothing new published the one on
+    // screen is left there, unless the window needs it drawn again
+
+    void render_frame(
+        float elapsed)
+    {
+        const auto is_new_frame = m_frames.acquire();
+
+        if (!is_new_frame && !m_needs_redraw)
+        {
+            return;
+        }
+
+        m_needs_redraw = false;
+
+        const auto &front = m_frames.front();
+
+        // A frame drawn again keeps its counts, but its build stages were already
+        // counted when it was first drawn
+
+        auto profile = front.profile;
+
+        profile.is_rebuilt = is_new_frame;
+
+        {
+            auto timer = Profiler::Timer(profile, Profiler::Stage::draw);
+
+            if (m_rasterizer.has_value())
+            {
+                draw_software(front, timer);
+            }
+            else
+            {
+                draw_renderer(front, timer);
+            }
+        }
+
+        m_profiler.add(profile);
+
+        if (m_window)
+        {
+            const auto s = std::format("GameEngine{} - fps: {} - chunks: {} occluded: {} - meshlets: {} culled: {} - clip accepted: {} rejected: {} clipped: {}", m_rasterizer.has_value() ? " (software)" : "", std::round(1.0f / elapsed), front.visible_chunks, front.occluded_chunks, front.visible_meshlets, front.culled_meshlets, front.clip_stats.accepted, front.clip_stats.rejected, front.clip_stats.clipped);
+
+            SDL_SetWindowTitle(m_window, s.c_str());
+        }
+    }
+
+    void toggle_profiler()
+    {
+        m_show_profiler = !m_show_profiler;
+
+        m_needs_redraw = true;
+    }
+
+    std::optional<Error> write_profile(
+        const std::string &filename) const
+    {
+        return m_profiler.write_csv(filename);
+    }
+
+    // Record the camera after every update from now on, written out with
+    // write_recording once the update thread has stopped
+
+    void start_recording()
+    {
+        m_is_recording = true;
+    }
+
+    // Print the camera whenever a simulation step moves it, for finding poses
+    // worth keeping
+
+    void enable_camera_printing()
+    {
+        m_print_camera = true;
+    }
+
+    std::optional<Error> write_recording(
+        const std::string &filename) const
+    {
+        return m_recording.write_to_file(filename);
+    }
+
+    // Build and draw `n_frames` frames from the current camera on the calling
+    // thread with no input
+
+    void run_headless(
+        int n_frames)
+    {
+        run_benchmark(std::vector<CameraPose>(n_frames, camera_pose(1.0f / 60.0f)));
+    }
+
+    // Build and draw one frame per pose on the calling thread with no input,
+    // rebuilding every frame so the timings cover the whole pipeline. Every pose
+    // steps the same fixed 1/60 s whatever the recording's frame rate was, and
+    // windowed backends draw to their window as they go
+
+    void run_benchmark(
+        const std::vector<CameraPose> &poses)
+    {
+        const auto elapsed = 1.0f / 60.0f;
+
+        const auto n_frames = static_cast<int>(poses.size());
+
+        auto build_time = std::chrono::nanoseconds(0);
+
+        auto raster_time = std::chrono::nanoseconds(0);
+
+        auto frame_times = std::vector<double>();
+
+        frame_times.reserve(poses.size());
+
+        for (const auto &pose : poses)
+        {
+            if (m_window)
+            {
+                SDL_PumpEvents();
+            }
+
+            set_camera_pose(pose);
+
+            m_frame_dirty = true;
+
+            const auto t1 = std::chrono::steady_clock::now();
+
+            on_update(elapsed, m_pending_input);
+
+            const auto t2 = std::chrono::steady_clock::now();
+
+            render_frame(elapsed);
+
+            const auto t3 = std::chrono::steady_clock::now();
+
+            build_time += t2 - t1;
+            raster_time += t3 - t2;
+
+            frame_times.push_back(std::chrono::duration<double, std::milli>(t3 - t1).count());
+        }
+
+        const auto ms = [n_frames](std::chrono::nanoseconds time)
+        {
+            return std::chrono::duration<double, std::milli>(time).count() / std::max(1, n_frames);
+        };
+
+        const auto &front = m_frames.front();
+
+        const auto &stats = front.clip_stats;
+
+        std::println("benchmark: {} frames {}x{} - build {:.3f} ms - raster {:.3f} ms - chunks: {} occluded: {} - meshlets: {} culled: {} - clip accepted: {} rejected: {} clipped: {}", n_frames, m_width, m_height, ms(build_time), ms(raster_time), front.visible_chunks, front.occluded_chunks, front.visible_meshlets, front.culled_meshlets, stats.accepted, stats.rejected, stats.clipped);
+
+        if (!frame_times.empty())
+        {
+            std::sort(frame_times.begin(), frame_times.end());
+
+            const auto frame_ms = [&frame_times](int percent)
+            {
+                return frame_times[std::min(frame_times.size() - 1, frame_times.size() * percent / 100)];
+            };
 
-                    light_direction = Vec4::normalize(light_direction);
+            std::println("  frame - p50 {:.3f} ms - p95 {:.3f} ms - p99 {:.3f} ms - max {:.3f} ms", frame_ms(50), frame_ms(95), frame_ms(99), frame_times.back());
+        }
 
-                    // How "aligned" are light direction and triangle surface normal?
+        for (auto s = 0; s < Profiler::stage_count; s++)
+        {
+            const auto stage = static_cast<Profiler::Stage>(s);
 
-                    const auto dp = std::max(0.1f, Vec4::dot_product(normal, light_direction));
+            const auto percentile_ms = [this, stage](int percent)
+            {
+                return static_cast<double>(m_profiler.percentile(stage, percent)) / 1.0e6;
+            };
 
-                    tri_transformed.set_color({static_cast<uint8_t>(tri_transformed.color().r * dp),
-                                               static_cast<uint8_t>(tri_transformed.color().g * dp),
-                                               static_cast<uint8_t>(tri_transformed.color().b * dp),
-                                               tri_transformed.color().a});
+            std::println("  {} - p50 {:.3f} ms - p95 {:.3f} ms - p99 {:.3f} ms", Profiler::stage_names[s], percentile_ms(50), percentile_ms(95), percentile_ms(99));
+        }
+    }
 
-                    // Convert World Space --> View space
+    // Save the last rasterized frame, only the software backends have one
 
-                    tri_viewed.set_point_at(0, Matrix4x4::multiply_vector(view, tri_transformed.point_at(0)));
-                    tri_viewed.set_point_at(1, Matrix4x4::multiply_vector(view, tri_transformed.point_at(1)));
-                    tri_viewed.set_point_at(2, Matrix4x4::multiply_vector(view, tri_transformed.point_at(2)));
-                    tri_viewed.set_color(tri_transformed.color());
+    std::optional<Error> write_png(
+        const std::string &filename) const
+    {
+        if (!m_rasterizer.has_value())
+        {
+            return Error("png", "png output needs --software or --headless");
+        }
 
-                    // Clip Viewed Triangle against near plane, this could form two additional
-                    // additional triangles.
+        return m_rasterizer->write_png(filename);
+    }
 
-                    auto clipped_triangles = 0;
+private:
+    static constexpr Color clear_color = Color{0x29, 0x23, 0x2a, 0xff}; // hybrid 2
 
-                    Triangle clipped[2] = {Triangle{}, Triangle{}};
+    CameraPose camera_pose(
+        float elapsed) const
+    {
+        return CameraPose{m_camera, m_yaw, m_pitch, m_roll, elapsed};
+    }
 
-                    clipped_triangles = Triangle::clip_against_plane({0.0f, 0.0f, 0.1f, 1.0f}, {0.0f, 0.0f, 1.0f, 1.0f}, tri_viewed, &clipped[0], &clipped[1]);
+    void set_camera_pose(
+        const CameraPose &pose)
+    {
+        m_camera = pose.camera;
+        m_yaw = pose.yaw;
+        m_pitch = pose.pitch;
+        m_roll = pose.roll;
+    }
 
-                    for (auto n = 0; n < clipped_triangles; n++)
-                    {
-                        // Project triangles from 3D --> 2D
+    void draw_software(
+        const FrameBuffers &front,
+        Profiler::Timer &timer)
+    {
+        m_rasterizer->draw(front, clear_color, m_render_wireframes);
 
-                        tri_projected.set_point_at(0, Matrix4x4::multiply_vector(m_projection_matrix, clipped[n].point_at(0)));
-                        tri_projected.set_point_at(1, Matrix4x4::multiply_vector(m_projection_matrix, clipped[n].point_at(1)));
-                        tri_projected.set_point_at(2, Matrix4x4::multiply_vector(m_projection_matrix, clipped[n].point_at(2)));
-                        tri_projected.set_color(clipped[n].color());
+        if (m_backend == Backend::headless || m_rasterizer->width() == 0)
+        {
+            return;
+        }
 
-                        // Scale into view, we moved the normalising into cartesian space
-                        // out of the matrix.vector function from the previous videos, so
-                        // do this manually
+        if (!m_texture || m_texture_width != m_rasterizer->width() || m_texture_height != m_rasterizer->height())
+        {
+            if (m_texture)
+            {
+                SDL_DestroyTexture(m_texture);
+            }
 
-                        tri_projected.set_point_at(0, Vec4::divide(tri_projected.point_at(0), tri_projected.point_at(0).w()));
-                        tri_projected.set_point_at(1, Vec4::divide(tri_projected.point_at(1), tri_projected.point_at(1).w()));
-                        tri_projected.set_point_at(2, Vec4::divide(tri_projected.point_at(2), tri_projected.point_at(2).w()));
+            m_texture_width = m_rasterizer->width();
+            m_texture_height = m_rasterizer->height();
 
-                        // X/Y are inverted so put them back
+            m_texture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, m_texture_width, m_texture_height);
+        }
 
-                        tri_projected.set_x_on_point_at(0, tri_projected.point_at(0).x() * -1.0f);
-                        tri_projected.set_x_on_point_at(1, tri_projected.point_at(1).x() * -1.0f);
-                        tri_projected.set_x_on_point_at(2, tri_projected.point_at(2).x() * -1.0f);
-                        tri_projected.set_y_on_point_at(0, tri_projected.point_at(0).y() * -1.0f);
-                        tri_projected.set_y_on_point_at(1, tri_projected.point_at(1).y() * -1.0f);
-                        tri_projected.set_y_on_point_at(2, tri_projected.point_at(2).y() * -1.0f);
+        SDL_UpdateTexture(m_texture, nullptr, m_rasterizer->pixels(), m_texture_width * static_cast<int>(sizeof(uint32_t)));
 
-                        // Offset verts into visible normalised space
+        SDL_RenderTexture(m_renderer, m_texture, nullptr, nullptr);
 
-                        const auto offset_view = Vec4(1.0f, 1.0f, 0.0f, 1.0f);
+        draw_profiler();
 
-                        tri_projected.set_point_at(0, Vec4::add(tri_projected.point_at(0), offset_view));
-                        tri_projected.set_point_at(1, Vec4::add(tri_projected.point_at(1), offset_view));
-                        tri_projected.set_point_at(2, Vec4::add(tri_projected.point_at(2), offset_view));
+        timer.next(Profiler::Stage::present);
 
-                        tri_projected.set_x_on_point_at(0, tri_projected.point_at(0).x() * 0.5f * m_width);
-                        tri_projected.set_y_on_point_at(0, tri_projected.point_at(0).y() * 0.5f * m_height);
-                        tri_projected.set_x_on_point_at(1, tri_projected.point_at(1).x() * 0.5f * m_width);
-                        tri_projected.set_y_on_point_at(1, tri_projected.point_at(1).y() * 0.5f * m_height);
-                        tri_projected.set_x_on_point_at(2, tri_projected.point_at(2).x() * 0.5f * m_width);
-                        tri_projected.set_y_on_point_at(2, tri_projected.point_at(2).y() * 0.5f * m_height);
+        SDL_RenderPresent(m_renderer);
+    }
 
-                        // Store triangle for sorting
+    void draw_renderer(
+        const FrameBuffers &front,
+        Profiler::Timer &timer)
+    {
+        const auto &vertices = front.vertices;
 
-                        triangles.push_back(Triangle(tri_projected));
-                    }
-                }
-            }
-        }
+        const auto &vertex_indices = front.indices;
 
-        // Sort triangles from back to front
+        ///
 
-        std::sort(triangles.begin(), triangles.end(), [](const Triangle &a, const Triangle &b)
-                  {
-            const auto z1 = (a.point_at(0).z() + a.point_at(1).z() + a.point_at(2).z()) / 3.0f;
-            const auto z2 = (b.point_at(0).z() + b.point_at(1).z() + b.point_at(2).z()) / 3.0f;
+        SDL_SetRenderDrawColor(m_renderer, clear_color.r, clear_color.g, clear_color.b, clear_color.a);
 
-            return z1 > z2; });
+        SDL_RenderClear(m_renderer);
 
         ///
 
-        SDL_FPoint zero_text_coord = {};
+        SDL_RenderGeometry(m_renderer, nullptr, vertices.data(), static_cast<int>(vertices.size()), vertex_indices.data(), static_cast<int>(vertex_indices.size()));
 
         ///
 
-        // SDL_SetRenderDrawColor(m_renderer, 0xff, 0x00, 0x00, 0xff); // line color
+        timer.next(Profiler::Stage::draw_wireframe);
 
-        // SDL_SetRenderDrawBlendMode(m_renderer, SDL_BLENDMODE_BLEND);
-
-        ///
+        if (m_render_wireframes)
+        {
+            SDL_RenderGeometry(m_renderer, nullptr, front.wireframe_vertices.data(), static_cast<int>(front.wireframe_vertices.size()), front.wireframe_indices.data(), static_cast<int>(front.wireframe_indices.size()));
+        }
 
-        std::vector<Triangle> batched_triangles;
+        draw_profiler();
 
         ///
 
-        for (const auto triangle_to_raster : triangles)
-        {
-            Triangle clipped[2] = {Triangle{}, Triangle{}};
+        timer.next(Profiler::Stage::present);
 
-            ///
+        SDL_RenderPresent(m_renderer);
+    }
 
-            std::vector<Triangle> inner_triangles;
+    // One row of bars per stage in Profiler::Stage order, p99 over p95 over p50
+    // from light to dark, a full bar being a 60 fps frame. Below them the last
+    // frame's triangles in, culled and emitted, against triangles in
 
-            inner_triangles.push_back(triangle_to_raster);
+    void draw_profiler()
+    {
+        if (!m_show_profiler)
+        {
+            return;
+        }
 
-            ///
+        const auto budget = 1.0e9f / 60.0f;
 
-            auto new_triangles = 1;
+        const auto bar_width = 400.0f * m_scale;
+        const auto bar_height = 8.0f * m_scale;
+        const auto row_height = 12.0f * m_scale;
+        const auto margin = 8.0f * m_scale;
 
-            for (auto p = 0; p < 4; p++)
-            {
-                auto tris_to_add = 0;
+        const auto n_rows = Profiler::stage_count + 3;
 
-                while (new_triangles > 0)
-                {
-                    const auto test = inner_triangles.front();
+        const auto background = SDL_FRect{0.0f, 0.0f, bar_width + margin * 2.0f, row_height * n_rows + margin * 2.0f};
 
-                    inner_triangles.erase(inner_triangles.begin());
+        SDL_SetRenderDrawColor(m_renderer, 0x00, 0x00, 0x00, 0xff);
 
-                    new_triangles--;
+        SDL_RenderFillRect(m_renderer, &background);
 
-                    switch (p)
-                    {
-                    case 0:
-                    {
-                        tris_to_add = Triangle::clip_against_plane({0.0f, 0.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 1.0f}, test, &clipped[0], &clipped[1]);
+        const auto bar = [&](int row, float fraction)
+        {
+            return SDL_FRect{margin, margin + row_height * row, bar_width * std::clamp(fraction, 0.0f, 1.0f), bar_height};
+        };
 
-                        break;
-                    }
+        const int percents[] = {99, 95, 50};
 
-                    case 1:
-                    {
-                        tris_to_add = Triangle::clip_against_plane({0.0f, m_height - 1.0f, 0.0f, 1.0f}, {0.0f, -1.0f, 0.0f, 1.0f}, test, &clipped[0], &clipped[1]);
+        const Color colors[] = {{0xff, 0xe0, 0x80, 0xff}, {0xff, 0xa0, 0x40, 0xff}, {0xc0, 0x40, 0x20, 0xff}};
 
-                        break;
-                    }
+        SDL_FRect rects[Profiler::stage_count];
 
-                    case 2:
-                    {
-                        tris_to_add = Triangle::clip_against_plane({0.0f, 0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f, 1.0f}, test, &clipped[0], &clipped[1]);
+        for (auto p = 0; p < 3; p++)
+        {
+            for (auto s = 0; s < Profiler::stage_count; s++)
+            {
+                rects[s] = bar(s, static_cast<float>(m_profiler.percentile(static_cast<Profiler::Stage>(s), percents[p])) / budget);
+            }
 
-                        break;
-                    }
+            SDL_SetRenderDrawColor(m_renderer, colors[p].r, colors[p].g, colors[p].b, colors[p].a);
 
-                    case 3:
-                    {
-                        tris_to_add = Triangle::clip_against_plane({m_width - 1.0f, 0.0f, 0.0f, 1.0f}, {-1.0f, 0.0f, 0.0f, 1.0f}, test, &clipped[0], &clipped[1]);
+            SDL_RenderFillRects(m_renderer, rects, Profiler::stage_count);
+        }
 
-                        break;
-                    }
-                    }
+        const auto &last = m_profiler.last();
 
-                    for (auto w = 0; w < tris_to_add; w++)
-                    {
-                        inner_triangles.push_back(Triangle{clipped[w].point_at(0), clipped[w].point_at(1), clipped[w].point_at(2), clipped[w].color()});
-                    }
-                }
+        const auto triangles_in = static_cast<float>(std::max(1, last.triangles_in));
 
-                new_triangles = inner_triangles.size();
-            }
+        const SDL_FRect counts[] = {
+            bar(Profiler::stage_count, 1.0f),
+            bar(Profiler::stage_count + 1, static_cast<float>(last.triangles_culled) / triangles_in),
+            bar(Profiler::stage_count + 2, static_cast<float>(last.triangles_emitted) / triangles_in)};
 
-            ///
+        SDL_SetRenderDrawColor(m_renderer, 0x60, 0xa0, 0xff, 0xff);
 
-            for (const auto it : inner_triangles)
-            {
-                batched_triangles.push_back(Triangle{it.point_at(0), it.point_at(1), it.point_at(2), it.color()});
-            }
-        }
+        SDL_RenderFillRects(m_renderer, counts, 3);
+    }
 
-        ///
+    // Work is only spread over the pool once there is enough to go around
 
-        const auto n_vertices = batched_triangles.size() * 3;
+    int slice_count(
+        int n) const
+    {
+        constexpr auto min_per_slice = 2048;
 
-        SDL_Vertex vertices[n_vertices];
+        return std::clamp(n / min_per_slice, 1, static_cast<int>(m_workers.thread_count()));
+    }
 
-        auto i = 0;
+    // Run `task` for slices [0, n_slices) on the pool and wait for them all, a
+    // single slice runs on the calling thread
 
-        for (const auto t : batched_triangles)
+    template <typename F>
+    void run_slices(
+        int n_slices,
+        F &&task)
+    {
+        if (n_slices <= 1)
         {
-            SDL_FColor color{static_cast<float>(t.color().r) / 255.0f, static_cast<float>(t.color().g) / 255.0f, static_cast<float>(t.color().b) / 255.0f, static_cast<float>(t.color().a) / 255.0f};
-
-            SDL_FPoint l0 = {t.point_at(0).x(), t.point_at(0).y()};
-            SDL_FPoint l1 = {t.point_at(1).x(), t.point_at(1).y()};
-            SDL_FPoint l2 = {t.point_at(2).x(), t.point_at(2).y()};
-
-            vertices[(i * 3) + 0] = SDL_Vertex{l0, color, zero_text_coord};
-            vertices[(i * 3) + 1] = SDL_Vertex{l1, color, zero_text_coord};
-            vertices[(i * 3) + 2] = SDL_Vertex{l2, color, zero_text_coord};
+            task(0);
 
-            i++;
+            return;
         }
 
-        ///
-
-        SDL_SetRenderDrawColor(m_renderer, 0x29, 0x23, 0x2a, 0xff); // hybrid 2
+        for (auto s = 0; s < n_slices; s++)
+        {
+            m_workers.enqueue_task([&task, s]()
+                                   { task(s); });
+        }
 
-        SDL_RenderClear(m_renderer);
+        m_workers.wait();
+    }
 
-        // std::println("renderer: {}", SDL_GetRendererName(m_renderer));
+    // Cut `ranges` into `n_slices` runs of roughly equal size, slice s covering
+    // pieces [bounds[s], bounds[s + 1])
 
-        
+    static void split_ranges(
+        const std::vector<IndexRange> &ranges,
+        int n_slices,
+        std::vector<IndexRange> &pieces,
+        std::vector<int> &bounds)
+    {
+        pieces.clear();
 
-        
+        bounds.clear();
 
-        ///
+        auto total = 0;
 
-        SDL_RenderGeometry(m_renderer, nullptr, vertices, n_vertices, nullptr, 0);
+        for (const auto &range : ranges)
+        {
+            total += range.count;
+        }
 
-        ///
+        bounds.push_back(0);
 
-        SDL_SetRenderDrawColor(m_renderer, 0x00, 0x00, 0x00, 0x07);
+        auto slice = 0;
 
-        // for (const auto it : batched_triangles)
-        // {
-        //     if (m_render_wireframes)
-        //     {
-        //         SDL_RenderLine(m_renderer, it.point_at(0).x(), it.point_at(0).y(), it.point_at(1).x(), it.point_at(1).y());
-        //         SDL_RenderLine(m_renderer, it.point_at(1).x(), it.point_at(1).y(), it.point_at(2).x(), it.point_at(2).y());
-        //         SDL_RenderLine(m_renderer, it.point_at(2).x(), it.point_at(2).y(), it.point_at(0).x(), it.point_at(0).y());
-        //     }
-        // }
+        auto filled = 0;
 
-        for (const auto it : batched_triangles)
+        for (auto range : ranges)
         {
-            SDL_FPoint lines[3] = {
-                {it.point_at(0).x(), it.point_at(0).y()},
-                {it.point_at(1).x(), it.point_at(1).y()},
-                {it.point_at(2).x(), it.point_at(2).y()}};
+            while (range.count > 0)
+            {
+                const auto target = static_cast<int>(static_cast<int64_t>(total) * (slice + 1) / n_slices);
 
-            SDL_RenderLines(m_renderer, lines, 3);
+                const auto take = std::min(range.count, std::max(0, target - filled));
 
-            // if (m_render_wireframes)
-            // {
-            //     SDL_RenderLine(m_renderer, it.point_at(0).x(), it.point_at(0).y(), it.point_at(1).x(), it.point_at(1).y());
-            //     SDL_RenderLine(m_renderer, it.point_at(1).x(), it.point_at(1).y(), it.point_at(2).x(), it.point_at(2).y());
-            //     SDL_RenderLine(m_renderer, it.point_at(2).x(), it.point_at(2).y(), it.point_at(0).x(), it.point_at(0).y());
-            // }
-        }
+                if (take > 0)
+                {
+                    pieces.push_back(IndexRange{range.first, take});
 
-        ///
+                    range.first += take;
+                    range.count -= take;
 
-        SDL_RenderPresent(m_renderer);
+                    filled += take;
+                }
 
-        const auto s = std::format("GameEngine - fps: {}", std::round(1.0f / elapsed));
+                if (filled >= target && slice < n_slices - 1)
+                {
+                    bounds.push_back(static_cast<int>(pieces.size()));
 
-        SDL_SetWindowTitle(m_window, s.c_str());
-    }
+                    slice++;
+                }
+            }
+        }
 
-    const Vec4 &camera() const
-    {
-        return m_camera;
+        while (static_cast<int>(bounds.size()) < n_slices + 1)
+        {
+            bounds.push_back(static_cast<int>(pieces.size()));
+        }
     }
 
-    const Vec4 &look_direction() const
+    static float average_depth(
+        const VertexBatch &points,
+        int i0,
+        int i1,
+        int i2)
     {
-        return m_look_direction;
-    }
+        const auto screen_z = points.screen_z();
 
-    void set_camera(
-        const Vec4 &camera)
-    {
-        m_camera = camera;
+        return (screen_z[i0] + screen_z[i1] + screen_z[i2]) / 3.0f;
     }
 
-    void set_look_direction(
-        const Vec4 &look_direction)
+    static bool is_same_color(
+        const SDL_FColor &a,
+        const SDL_FColor &b)
     {
-        m_look_direction = look_direction;
+        return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
     }
 
-private:
     SDL_Window *m_window = nullptr;
     SDL_Renderer *m_renderer = nullptr;
+    Backend m_backend = Backend::renderer;
+    std::optional<SoftwareRasterizer> m_rasterizer;
+    SDL_Texture *m_texture = nullptr;
+    int m_texture_width = 0;
+    int m_texture_height = 0;
     int m_screen_width;
     int m_screen_height;
     int m_size;
@@ -1482,64 +5115,285 @@ private:
     float m_width;
     float m_height;
     float m_size_f;
-    Matrix4x4 m_projection_matrix;
+    Camera m_eye;
     Vec4 m_camera;
-    Vec4 m_look_direction;
     float m_yaw;
     float m_pitch;
     float m_roll;
     float m_theta = 0.0f;
     bool m_render_wireframes = true;
+
+    Profiler m_profiler;
+    bool m_show_profiler = false;
+
+    CameraPath m_recording;
+    bool m_is_recording = false;
+    bool m_print_camera = false;
+    bool m_occlusion_culling = true;
     std::optional<Mesh> m_mesh;
+    std::optional<Terrain> m_terrain;
+    DepthSorter m_depth_sorter;
+
+    // Retained geometry and the state it was built from
+
+    FrameArena m_arena;
+    WorkProcessor m_workers{WorkProcessor::default_thread_count()};
+    TripleBuffer<FrameBuffers> m_frames;
+    int m_frame_camera_revision = -1;
+    int m_frame_mesh_revision = 0;
+    bool m_frame_dirty = true;
+    bool m_needs_redraw = true;
+    Uint32 m_frame_event = 0;
+
+    // Input handed from the main thread to the update thread
+
+    InputState m_pending_input;
+    InputState m_input;
+    uint64_t m_input_sequence = 0;
+    Uint64 m_input_active_until = 0;
+    bool m_stop_update = false;
+    std::mutex m_input_mutex;
+    std::condition_variable m_input_changed;
+    std::thread m_update_thread;
 };
 
-int main()
+// Sleep until `deadline` on the SDL_GetTicksNS clock. SDL_DelayNS waits on the
+// platform's high resolution timer, so the whole wait is left to it
+
+void delay_until(
+    Uint64 deadline)
+{
+    const auto now = SDL_GetTicksNS();
+
+    if (now < deadline)
+    {
+        SDL_DelayNS(deadline - now);
+    }
+}
+
+int main(
+    int argc,
+    char *argv[])
 {
     std::println("sdl version: {}", SDL_GetVersion());
 
     ///
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    auto backend = Game::Backend::renderer;
+
+    auto obj_filename = std::optional<std::string>();
+
+    auto png_filename = std::optional<std::string>();
+
+    auto profile_filename = std::optional<std::string>();
+
+    auto record_filename = std::optional<std::string>();
+
+    auto replay_filename = std::optional<std::string>();
+
+    auto n_frames = 1;
+
+    auto fps_cap = 0;
+
+    auto is_printing_camera = false;
+
+    // const auto game_size = 128;
+    // const auto game_size = 64;
+    auto game_size = 48;
+
+    for (auto i = 1; i < argc; i++)
+    {
+        const auto arg = std::string(argv[i]);
+
+        if (arg == "--obj" && i + 1 < argc)
+        {
+            obj_filename = argv[++i];
+        }
+        else if (arg == "--software")
+        {
+            backend = Game::Backend::software;
+        }
+        else if (arg == "--headless")
+        {
+            backend = Game::Backend::headless;
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            n_frames = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--png" && i + 1 < argc)
+        {
+            png_filename = argv[++i];
+        }
+        else if (arg == "--profile" && i + 1 < argc)
+        {
+            profile_filename = argv[++i];
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            record_filename = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replay_filename = argv[++i];
+        }
+        else if (arg == "--print-camera")
+        {
+            is_printing_camera = true;
+        }
+        else if (arg == "--fps-cap" && i + 1 < argc)
+        {
+            fps_cap = std::max(0, std::atoi(argv[++i]));
+        }
+        else if (arg == "--size" && i + 1 < argc)
+        {
+            game_size = std::max(16, std::atoi(argv[++i]));
+        }
+    }
+
+    ///
+
+    // Headless runs don't need a display, so don't ask for one
+
+    if (SDL_Init(backend == Game::Backend::headless ? 0 : SDL_INIT_VIDEO) != 0)
     {
         std::println("SDL_Init Error: {}", SDL_GetError());
 
         return 1;
     }
 
+    MathBackend::initialize();
+
+    std::println("math kernels: {}", MathBackend::kernels().name);
+
     ///
 
     {
         // main loop
 
-        // const auto game_size = 128;
-        // const auto game_size = 64;
-        const auto game_size = 48;
-
-        Game game(1280, 832, game_size);
+        Game game(1280, 832, game_size, backend);
 
         game.on_create();
 
-        ///
+        if (obj_filename.has_value())
+        {
+            const auto error = game.load_model(*obj_filename);
 
-        auto quit = false;
+            if (error.has_value())
+            {
+                // Keep the terrain rather than showing an empty scene
 
-        ///
+                std::println("load error: {} {}", error->type(), error->message().value_or(""));
+            }
+        }
+
+        const auto save_png = [&game, &png_filename]()
+        {
+            if (!png_filename.has_value())
+            {
+                return;
+            }
+
+            const auto error = game.write_png(*png_filename);
+
+            if (error.has_value())
+            {
+                std::println("png error: {} {}", error->type(), error->message().value_or(""));
+            }
+        };
+
+        const auto save_profile = [&game, &profile_filename]()
+        {
+            if (!profile_filename.has_value())
+            {
+                return;
+            }
+
+            const auto error = game.write_profile(*profile_filename);
+
+            if (error.has_value())
+            {
+                std::println("profile error: {} {}", error->type(), error->message().value_or(""));
+            }
+        };
+
+        // A replay runs the recorded path on this thread and quits, in a window
+        // unless headless
+
+        if (replay_filename.has_value())
+        {
+            auto result = CameraPath::load_from_file(*replay_filename);
+
+            if (std::holds_alternative<Error>(result))
+            {
+                const auto &error = std::get<Error>(result);
+
+                std::println("replay error: {} {}", error.type(), error.message().value_or(""));
+
+                SDL_Quit();
+
+                return 1;
+            }
+
+            game.run_benchmark(std::get<CameraPath>(result).poses());
 
-        auto elapsed = 0.0f;
+            save_png();
+
+            save_profile();
+
+            SDL_Quit();
+
+            return 0;
+        }
+
+        if (backend == Game::Backend::headless)
+        {
+            game.run_headless(n_frames);
+
+            save_png();
+
+            save_profile();
+
+            SDL_Quit();
+
+            return 0;
+        }
+
+        if (record_filename.has_value())
+        {
+            game.start_recording();
+        }
+
+        if (is_printing_camera)
+        {
+            game.enable_camera_printing();
+        }
+
+        // The interactive loop is paced by vsync, or by a cap where the renderer
+        // can't wait for it. Benchmarks and headless runs stay unpaced
+
+        if (!game.enable_vsync() && fps_cap == 0)
+        {
+            fps_cap = 60;
+        }
+
+        game.start_update_thread();
 
         ///
 
-        auto t1 = SDL_GetTicks();
+        auto quit = false;
+
+        ///
 
-        auto t2 = t1;
+        auto t1 = SDL_GetTicksNS();
 
         ///
 
         while (!quit)
         {
-            t2 = SDL_GetTicks();
+            const auto t2 = SDL_GetTicksNS();
 
-            auto elapsed = static_cast<float>(t2 - t1) / 1000.0f;
+            const auto elapsed = static_cast<float>(static_cast<double>(t2 - t1) / 1.0e9);
 
             t1 = t2;
 
@@ -1553,24 +5407,21 @@ int main()
                 {
                 case SDL_EVENT_MOUSE_WHEEL:
                 {
-                    const auto forward = Vec4::multiply(game.look_direction(), 8.0f * elapsed);
-
-                    if (event.wheel.y > 0)
-                    {
-                        const auto c = Vec4::subtract(game.camera(), forward);
+                    game.on_mouse_wheel(event.wheel.y);
 
-                        game.set_camera(Vec4(c.x(), c.y() + (8.0f * elapsed), c.z(), c.w()));
+                    break;
+                }
 
-                        game.print_camera();
-                    }
-                    else if (event.wheel.y < 0)
-                    {
-                        const auto c = Vec4::add(game.camera(), forward);
+                case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+                {
+                    game.on_resize();
 
-                        game.set_camera(Vec4(c.x(), c.y() - (8.0f * elapsed), c.z(), c.w()));
+                    break;
+                }
 
-                        game.print_camera();
-                    }
+                case SDL_EVENT_WINDOW_EXPOSED:
+                {
+                    game.on_expose();
 
                     break;
                 }
@@ -1588,9 +5439,13 @@ int main()
                     {
                     case SDL_SCANCODE_R:
 
-                        game.reset_camera();
+                        game.on_reset();
 
-                        game.print_camera();
+                        break;
+
+                    case SDL_SCANCODE_P:
+
+                        game.toggle_profiler();
 
                         break;
 
@@ -1616,7 +5471,52 @@ int main()
 
             ///
 
-            game.on_update(elapsed);
+            // The update thread picks this up while the last finished frame is drawn
+
+            game.submit_input();
+
+            game.render_frame(elapsed);
+
+            if (fps_cap > 0)
+            {
+                delay_until(t2 + 1000000000ull / static_cast<Uint64>(fps_cap));
+            }
+
+            if (quit)
+            {
+                break;
+            }
+
+            ///
+
+            // With the camera still, sleep until an event or a finished frame wakes
+            // the loop rather than going round it again for nothing. While it may
+            // still move, held keys are submitted at least once a step
+
+            if (game.is_input_active())
+            {
+                SDL_WaitEventTimeout(nullptr, static_cast<Sint32>(Game::simulation_step * 1000.0f));
+            }
+            else
+            {
+                SDL_WaitEvent(nullptr);
+            }
+        }
+
+        game.stop_update_thread();
+
+        save_png();
+
+        save_profile();
+
+        if (record_filename.has_value())
+        {
+            const auto error = game.write_recording(*record_filename);
+
+            if (error.has_value())
+            {
+                std::println("record error: {} {}", error->type(), error->message().value_or(""));
+            }
         }
     }
 
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <print>
+#include <vector>
+
+#include "Math.h"
+#include "MathBackend.h"
+
+// Runs every kernel set this CPU supports, forced in turn, against the scalar
+// kernels. Inputs are mostly random, with the edge cases appended: zero length
+// vectors, denormals, points on the clip planes and at or behind w = 0
+
+static int s_failures = 0;
+
+static void check(
+    bool condition,
+    const char *kernels,
+    const char *what)
+{
+    if (!condition)
+    {
+        std::println("FAILED: {} {}", kernels, what);
+
+        s_failures++;
+    }
+}
+
+// Non finite results have to come out the same, finite ones close enough
+
+static bool agrees(
+    const std::vector<float> &expected,
+    const std::vector<float> &actual)
+{
+    for (auto i = 0; i < static_cast<int>(expected.size()); i++)
+    {
+        const auto e = expected[i];
+        const auto r = actual[i];
+
+        if (std::isnan(e) || std::isnan(r))
+        {
+            if (std::isnan(e) != std::isnan(r))
+            {
+                return false;
+            }
+        }
+        else if (std::isinf(e) || std::isinf(r))
+        {
+            if (e != r)
+            {
+                return false;
+            }
+        }
+        else if (std::abs(e - r) > 1e-5f * std::max(1.0f, std::abs(e)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool agrees(
+    const std::vector<float> (&expected)[7],
+    const std::vector<float> (&actual)[7],
+    int arrays)
+{
+    for (auto a = 0; a < arrays; a++)
+    {
+        if (!agrees(expected[a], actual[a]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Six columns, x y z of two vectors or x y z w of a clip space point
+
+struct Inputs
+{
+    std::vector<float> columns[6];
+
+    void push(
+        float a,
+        float b,
+        float c,
+        float d,
+        float e,
+        float f)
+    {
+        const float row[6] = {a, b, c, d, e, f};
+
+        for (auto i = 0; i < 6; i++)
+        {
+            columns[i].push_back(row[i]);
+        }
+    }
+
+    int count() const { return static_cast<int>(columns[0].size()); }
+};
+
+static Inputs make_inputs()
+{
+    auto inputs = Inputs();
+
+    // Spread over +/- 100, so every clip plane gets points on both sides
+
+    auto seed = 0x2545f491u;
+
+    const auto next = [&seed]()
+    {
+        seed = seed * 1664525u + 1013904223u;
+
+        return static_cast<float>(seed >> 8) / static_cast<float>(1 << 24) * 200.0f - 100.0f;
+    };
+
+    for (auto i = 0; i < 1000; i++)
+    {
+        inputs.push(next(), next(), next(), next(), next(), next());
+    }
+
+    const auto denormal = std::numeric_limits<float>::denorm_min();
+    const auto small = std::numeric_limits<float>::min() / 8.0f;
+    const auto nan = std::numeric_limits<float>::quiet_NaN();
+
+    // Zero length vectors, and ones whose squared length underflows
+
+    inputs.push(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+    inputs.push(-0.0f, 0.0f, -0.0f, 1.0f, 2.0f, 3.0f);
+    inputs.push(denormal, -denormal, denormal, small, -small, small);
+    inputs.push(small, 0.0f, 0.0f, 0.0f, small, 0.0f);
+    inputs.push(3.0f * denormal, 1.0f, -2.0f, 5.0f, denormal, 0.5f);
+
+    // Points exactly on the screen and guard band planes, with w away from 1,
+    // at 0 and behind the camera
+
+    inputs.push(4.0f, -4.0f, 0.0f, 4.0f, 0.0f, 0.0f);
+    inputs.push(12.0f, -12.0f, 4.0f, 4.0f, 0.0f, 0.0f);
+    inputs.push(-0.5f, 0.5f, 0.25f, 0.5f, 0.0f, 0.0f);
+    inputs.push(1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+    inputs.push(0.0f, 0.0f, 0.0f, -0.0f, 0.0f, 0.0f);
+    inputs.push(2.0f, -3.0f, -1.0f, -2.0f, 0.0f, 0.0f);
+    inputs.push(denormal, -denormal, denormal, denormal, 0.0f, 0.0f);
+    inputs.push(nan, 1.0f, nan, 1.0f, 0.0f, 0.0f);
+
+    // Leave some over for the remainder loops after the 4 and 8 wide ones
+
+    if (inputs.count() % 4 == 0)
+    {
+        inputs.push(1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f);
+    }
+
+    return inputs;
+}
+
+static void test_transform(
+    const Inputs &inputs,
+    const char *name)
+{
+    const auto n = inputs.count();
+
+    const auto &in = inputs.columns;
+
+    // The projection puts the view depth in w, the other matrix gives every point
+    // a w of its own
+
+    const Matrix4x4 matrices[] = {
+        Matrix4x4::make_projection(90.0f, 0.65f, 0.1f, 1000.0f),
+        Matrix4x4(
+            0.5f, 1.0f, -2.0f, 0.25f,
+            3.0f, -0.5f, 0.0f, -1.5f,
+            0.0f, 2.0f, 1.0f, 0.75f,
+            -4.0f, 0.0f, 8.0f, 2.0f)};
+
+    for (const auto &m : matrices)
+    {
+        std::vector<float> expected[7], actual[7];
+
+        for (auto i = 0; i < 7; i++)
+        {
+            expected[i].resize(n);
+            actual[i].resize(n);
+        }
+
+        MathBackend::scalar().transform(m, in[0].data(), in[1].data(), in[2].data(), expected[0].data(), expected[1].data(), expected[2].data(), expected[3].data(), expected[4].data(), expected[5].data(), expected[6].data(), n, 640.0f, 416.0f);
+        MathBackend::kernels().transform(m, in[0].data(), in[1].data(), in[2].data(), actual[0].data(), actual[1].data(), actual[2].data(), actual[3].data(), actual[4].data(), actual[5].data(), actual[6].data(), n, 640.0f, 416.0f);
+
+        check(agrees(expected, actual, 7), name, "transform");
+    }
+}
+
+static void test_cross_product_and_normalize(
+    const Inputs &inputs,
+    const char *name)
+{
+    const auto n = inputs.count();
+
+    const auto &in = inputs.columns;
+
+    std::vector<float> expected[7], actual[7];
+
+    for (auto i = 0; i < 3; i++)
+    {
+        expected[i].resize(n);
+        actual[i].resize(n);
+    }
+
+    MathBackend::scalar().cross_product(in[0].data(), in[1].data(), in[2].data(), in[3].data(), in[4].data(), in[5].data(), expected[0].data(), expected[1].data(), expected[2].data(), n);
+    MathBackend::kernels().cross_product(in[0].data(), in[1].data(), in[2].data(), in[3].data(), in[4].data(), in[5].data(), actual[0].data(), actual[1].data(), actual[2].data(), n);
+
+    check(agrees(expected, actual, 3), name, "cross_product");
+
+    // Normalized straight from the inputs as well, so the zero length and
+    // denormal vectors get there unchanged
+
+    for (auto i = 0; i < 3; i++)
+    {
+        expected[i] = in[i];
+        actual[i] = in[i];
+    }
+
+    MathBackend::scalar().normalize(expected[0].data(), expected[1].data(), expected[2].data(), n);
+    MathBackend::kernels().normalize(actual[0].data(), actual[1].data(), actual[2].data(), n);
+
+    check(agrees(expected, actual, 3), name, "normalize");
+
+    check(std::isnan(actual[0][1000]) && std::isnan(actual[1][1000]) && std::isnan(actual[2][1000]), name, "normalize of a zero length vector is NaN");
+}
+
+static void test_outcodes(
+    const Inputs &inputs,
+    const char *name)
+{
+    const auto n = inputs.count();
+
+    const auto &in = inputs.columns;
+
+    std::vector<uint8_t> expected[2], actual[2];
+
+    for (auto i = 0; i < 2; i++)
+    {
+        expected[i].resize(n);
+        actual[i].resize(n);
+    }
+
+    MathBackend::scalar().outcodes(in[0].data(), in[1].data(), in[2].data(), in[3].data(), expected[0].data(), expected[1].data(), n, 3.0f);
+    MathBackend::kernels().outcodes(in[0].data(), in[1].data(), in[2].data(), in[3].data(), actual[0].data(), actual[1].data(), n, 3.0f);
+
+    // Outcodes are comparisons, so they have to match exactly
+
+    check(expected[0] == actual[0], name, "screen outcodes");
+    check(expected[1] == actual[1], name, "guard band outcodes");
+}
+
+int main()
+{
+    const auto inputs = make_inputs();
+
+    for (const auto kernels : MathBackend::supported())
+    {
+        MathBackend::use(*kernels);
+
+        test_transform(inputs, kernels->name);
+
+        test_cross_product_and_normalize(inputs, kernels->name);
+
+        test_outcodes(inputs, kernels->name);
+
+        std::println("{} kernels checked", kernels->name);
+    }
+
+    if (s_failures > 0)
+    {
+        std::println("{} checks failed", s_failures);
+
+        return 1;
+    }
+
+    std::println("all checks passed");
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cmath>
+#include <print>
+#include <vector>
+
+#include "Geometry.h"
+#include "Math.h"
+
+// Checks for the matrix chains, the projection factory and triangle clipping.
+// Every failed check is printed, and the exit code is non zero if any failed
+
+static int s_failures = 0;
+
+static void check(
+    bool condition,
+    const char *what)
+{
+    if (!condition)
+    {
+        std::println("FAILED: {}", what);
+
+        s_failures++;
+    }
+}
+
+static bool is_close(
+    float expected,
+    float actual,
+    float tolerance = 1e-5f)
+{
+    return std::abs(expected - actual) <= tolerance * std::max(1.0f, std::abs(expected));
+}
+
+static bool is_same(
+    const Matrix4x4 &expected,
+    const Matrix4x4 &actual)
+{
+    for (auto r = 0; r < 4; r++)
+    {
+        for (auto c = 0; c < 4; c++)
+        {
+            if (expected.at(r, c) != actual.at(r, c))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool is_close(
+    const Matrix4x4 &expected,
+    const Matrix4x4 &actual)
+{
+    for (auto r = 0; r < 4; r++)
+    {
+        for (auto c = 0; c < 4; c++)
+        {
+            if (!is_close(expected.at(r, c), actual.at(r, c)))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool is_close(
+    const Vec4 &expected,
+    const Vec4 &actual)
+{
+    return is_close(expected.x(), actual.x()) && is_close(expected.y(), actual.y()) && is_close(expected.z(), actual.z()) && is_close(expected.w(), actual.w());
+}
+
+// The textbook product, one scalar multiply and add at a time
+
+static Matrix4x4 reference_multiply(
+    const Matrix4x4 &a,
+    const Matrix4x4 &b)
+{
+    float m[4][4] = {};
+
+    for (auto r = 0; r < 4; r++)
+    {
+        for (auto c = 0; c < 4; c++)
+        {
+            for (auto k = 0; k < 4; k++)
+            {
+                m[r][c] += a.at(r, k) * b.at(k, c);
+            }
+        }
+    }
+
+    return Matrix4x4(m);
+}
+
+static std::vector<Matrix4x4> make_matrices()
+{
+    auto matrices = std::vector<Matrix4x4>();
+
+    for (auto i = 0; i < 8; i++)
+    {
+        const auto angle = static_cast<float>(i) * 0.7f - 2.0f;
+
+        matrices.push_back(Matrix4x4::make_rotation_x(angle));
+        matrices.push_back(Matrix4x4::make_rotation_y(angle * 1.3f));
+        matrices.push_back(Matrix4x4::make_rotation_z(angle * 0.6f));
+        matrices.push_back(Matrix4x4::make_translation(angle, -2.0f * angle, 10.0f + angle));
+    }
+
+    matrices.push_back(Matrix4x4::make_projection(90.0f, 0.65f, 0.1f, 1000.0f));
+
+    return matrices;
+}
+
+static void test_multiply()
+{
+    const auto matrices = make_matrices();
+
+    for (auto i = 0; i + 3 < static_cast<int>(matrices.size()); i++)
+    {
+        const auto &a = matrices[i];
+        const auto &b = matrices[i + 1];
+        const auto &c = matrices[i + 2];
+        const auto &d = matrices[i + 3];
+
+        check(is_close(reference_multiply(a, b), Matrix4x4::multiply(a, b)), "multiply matches the scalar product");
+
+        // The chains sum in the same order as nesting, so they match exactly
+
+        check(is_same(Matrix4x4::multiply(Matrix4x4::multiply(a, b), c), Matrix4x4::multiply(a, b, c)), "three matrix chain matches nested multiply");
+
+        check(is_same(Matrix4x4::multiply(Matrix4x4::multiply(Matrix4x4::multiply(a, b), c), d), Matrix4x4::multiply(a, b, c, d)), "four matrix chain matches nested multiply");
+
+        check(is_close(reference_multiply(reference_multiply(reference_multiply(a, b), c), d), Matrix4x4::multiply(a, b, c, d)), "four matrix chain matches the scalar products");
+    }
+}
+
+static void test_transform()
+{
+    const auto matrices = make_matrices();
+
+    const Vec4 points[] = {Vec4(0.0f, 0.0f, 1.0f), Vec4(1.5f, -2.0f, 3.0f), Vec4(-40.0f, 12.0f, 7.5f)};
+
+    for (auto i = 0; i + 2 < static_cast<int>(matrices.size()); i++)
+    {
+        const auto &a = matrices[i];
+        const auto &b = matrices[i + 1];
+        const auto &c = matrices[i + 2];
+
+        for (const auto &p : points)
+        {
+            const auto nested = Matrix4x4::multiply_vector(c, Matrix4x4::multiply_vector(b, Matrix4x4::multiply_vector(a, p)));
+
+            check(is_close(nested, Matrix4x4::transform(p, a, b, c)), "transform matches nested multiply_vector");
+
+            // multiply_vector takes w as 1, which holds here as the projection is
+            // only ever last in the chain
+
+            check(is_close(Matrix4x4::multiply_vector(Matrix4x4::multiply(a, b, c), p), Matrix4x4::transform(p, a, b, c)), "transform matches the product of its matrices");
+        }
+    }
+}
+
+static void test_constexpr_tan()
+{
+    static_assert(Matrix4x4::constexpr_tan(0.0) == 0.0);
+
+    for (auto i = -12; i <= 12; i++)
+    {
+        const auto x = static_cast<double>(i) * 0.1;
+
+        check(std::abs(Matrix4x4::constexpr_tan(x) - std::tan(x)) <= 1e-9 * std::max(1.0, std::abs(std::tan(x))), "constexpr_tan matches std::tan");
+    }
+}
+
+static void test_make_projection()
+{
+    constexpr auto constant = Matrix4x4::make_projection(90.0f, 0.65f, 0.1f, 1000.0f);
+
+    // Read back through a volatile so this one is built at run time with std::tan
+
+    volatile auto fov = 90.0f;
+
+    const auto runtime = Matrix4x4::make_projection(fov, 0.65f, 0.1f, 1000.0f);
+
+    check(is_close(runtime, constant), "constant and run time projections match");
+
+    check(is_close(1.0f, runtime.at(1, 1)) && is_close(0.65f, runtime.at(0, 0)), "a 90 degree field of view scales by the aspect ratio only");
+
+    // Clip z runs from 0 at the near plane to w at the far plane
+
+    const auto near = Matrix4x4::multiply_vector(runtime, Vec4(0.0f, 0.0f, 0.1f));
+    const auto far = Matrix4x4::multiply_vector(runtime, Vec4(0.0f, 0.0f, 1000.0f));
+
+    check(std::abs(near.z()) <= 1e-6f && is_close(0.1f, near.w()), "the near plane maps to clip z 0");
+
+    check(is_close(far.w(), far.z()) && is_close(1000.0f, far.w()), "the far plane maps to clip z w");
+}
+
+static void test_clip_against_plane()
+{
+    // Keep everything on or above y = 0
+
+    const auto plane_p = Vec4(0.0f, 0.0f, 0.0f);
+    const auto plane_n = Vec4(0.0f, 2.0f, 0.0f);
+
+    const auto color = Color{0x10, 0x20, 0x30, 0xff};
+
+    Triangle out1;
+    Triangle out2;
+
+    {
+        const auto below = Triangle(0.0f, -1.0f, 0.0f, 1.0f, -2.0f, 0.0f, 0.0f, -1.0f, 1.0f, color);
+
+        check(Triangle::clip_against_plane(plane_p, plane_n, below, &out1, &out2) == 0, "a triangle behind the plane is dropped");
+    }
+
+    {
+        const auto above = Triangle(0.0f, 1.0f, 0.0f, 1.0f, 2.0f, 0.0f, 0.0f, 0.0f, 1.0f, color);
+
+        check(Triangle::clip_against_plane(plane_p, plane_n, above, &out1, &out2) == 1, "a triangle in front of the plane is kept");
+
+        for (auto i = 0; i < 3; i++)
+        {
+            check(is_close(above.point_at(i), out1.point_at(i)), "a kept triangle is unchanged");
+        }
+
+        check(out1.color().b == color.b, "a kept triangle keeps its colour");
+    }
+
+    {
+        const auto one_inside = Triangle(0.0f, 1.0f, 0.0f, 2.0f, -1.0f, 0.0f, 0.0f, -3.0f, 2.0f, color);
+
+        check(Triangle::clip_against_plane(plane_p, plane_n, one_inside, &out1, &out2) == 1, "one point in front of the plane leaves one triangle");
+
+        check(is_close(one_inside.point_at(0), out1.point_at(0)), "the point in front of the plane is kept");
+
+        check(is_close(Vec4(1.0f, 0.0f, 0.0f), out1.point_at(1)) && is_close(Vec4(0.0f, 0.0f, 0.5f), out1.point_at(2)), "the new points are where the edges cross the plane");
+
+        check(out1.color().r == color.r, "the smaller triangle keeps the colour");
+    }
+
+    {
+        const auto two_inside = Triangle(0.0f, 1.0f, 0.0f, 2.0f, 3.0f, 0.0f, 0.0f, -1.0f, 2.0f, color);
+
+        check(Triangle::clip_against_plane(plane_p, plane_n, two_inside, &out1, &out2) == 2, "two points in front of the plane leave a quad");
+
+        check(is_close(two_inside.point_at(0), out1.point_at(0)) && is_close(two_inside.point_at(1), out1.point_at(1)), "the first triangle keeps both points in front of the plane");
+
+        check(is_close(Vec4(0.0f, 0.0f, 1.0f), out1.point_at(2)), "the first triangle ends where an edge crosses the plane");
+
+        check(is_close(two_inside.point_at(1), out2.point_at(0)) && is_close(out1.point_at(2), out2.point_at(1)), "the second triangle shares an edge with the first");
+
+        check(is_close(Vec4(0.5f, 0.0f, 1.5f), out2.point_at(2)), "the second triangle ends where the other edge crosses the plane");
+
+        check(out1.color().g == color.g && out2.color().g == color.g, "both triangles keep the colour");
+    }
+}
+
+int main()
+{
+    test_multiply();
+
+    test_transform();
+
+    test_constexpr_tan();
+
+    test_make_projection();
+
+    test_clip_against_plane();
+
+    if (s_failures > 0)
+    {
+        std::println("{} checks failed", s_failures);
+
+        return 1;
+    }
+
+    std::println("all checks passed");
+
+    return 0;
+}